@@ -0,0 +1,242 @@
+/*
+ * Register snapshots as ELF core files, see core.h
+ *
+ * Licensed under GPLv2.
+ */
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "core.h"
+
+static const char zero[sizeof(struct core_prstatus)];
+
+/* Header and name of a note, the caller adds the descriptor */
+static void core_note_head(struct iovec *iov, unsigned int *n, Elf64_Nhdr *nhdr,
+			   uint32_t type, const char *name, size_t descsz)
+{
+	nhdr->n_namesz = strlen(name) + 1;
+	nhdr->n_descsz = descsz;
+	nhdr->n_type = type;
+
+	iov[*n].iov_base = nhdr;
+	iov[(*n)++].iov_len = sizeof(*nhdr);
+	iov[*n].iov_base = (void *)name;
+	iov[(*n)++].iov_len = nhdr->n_namesz;
+	iov[*n].iov_base = (void *)zero;
+	iov[(*n)++].iov_len = CORE_ALIGN(nhdr->n_namesz) - nhdr->n_namesz;
+}
+
+static size_t core_note_len(const Elf64_Nhdr *nhdr)
+{
+	return sizeof(*nhdr) + CORE_ALIGN(nhdr->n_namesz) + CORE_ALIGN(nhdr->n_descsz);
+}
+
+int snapshot_write_core(const char *path, const struct reg_snapshot *snap, pid_t pid)
+{
+	/*
+	 * Per note: header, name and its padding, descriptor in three
+	 * pieces.
+	 */
+	struct iovec iov[2 + 6 * ARRAY_SIZE(snapshot_regsets)];
+	Elf64_Nhdr nhdr[ARRAY_SIZE(snapshot_regsets)];
+	struct core_prstatus prstatus = { 0 };
+	size_t notes = 0, want, head, len, off;
+	Elf64_Ehdr ehdr = { { 0 } };
+	Elf64_Phdr phdr = { 0 };
+	unsigned int i, n = 0;
+	ssize_t ret;
+	int fd;
+
+	memcpy(ehdr.e_ident, ELFMAG, SELFMAG);
+	ehdr.e_ident[EI_CLASS] = ELFCLASS64;
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	ehdr.e_ident[EI_DATA] = ELFDATA2MSB;
+#else
+	ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+#endif
+	ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+	ehdr.e_type = ET_CORE;
+	ehdr.e_machine = EM_PPC64;
+	ehdr.e_version = EV_CURRENT;
+	ehdr.e_phoff = sizeof(ehdr);
+	ehdr.e_ehsize = sizeof(ehdr);
+	ehdr.e_phentsize = sizeof(phdr);
+	ehdr.e_phnum = 1;
+
+	iov[n].iov_base = &ehdr;
+	iov[n++].iov_len = sizeof(ehdr);
+	iov[n].iov_base = &phdr;
+	iov[n++].iov_len = sizeof(phdr);
+
+	prstatus.pid = pid;
+	prstatus.fpvalid = !!(snap->valid & SNAP_FPR);
+
+	for (i = 0; i < ARRAY_SIZE(snapshot_regsets); i++) {
+		const struct snapshot_regset *r = &snapshot_regsets[i];
+
+		if (!(snap->valid & r->flag))
+			continue;
+
+		core_note_head(iov, &n, &nhdr[i], core_notes[i].type,
+			       core_notes[i].name, core_note_size(i));
+
+		/* The GPRs sit inside the prstatus, the rest pads with zeroes */
+		head = core_regset_offset(i);
+		len = r->size < nhdr[i].n_descsz - head ? r->size : nhdr[i].n_descsz - head;
+		iov[n].iov_base = &prstatus;
+		iov[n++].iov_len = head;
+		iov[n].iov_base = (char *)snap + r->offset;
+		iov[n++].iov_len = len;
+		if (head) {
+			off = head + len;
+			iov[n].iov_base = (char *)&prstatus + off;
+			iov[n++].iov_len = sizeof(prstatus) - off;
+		} else {
+			iov[n].iov_base = (void *)zero;
+			iov[n++].iov_len = CORE_ALIGN(nhdr[i].n_descsz) - len;
+		}
+		notes += core_note_len(&nhdr[i]);
+	}
+
+	phdr.p_type = PT_NOTE;
+	phdr.p_offset = sizeof(ehdr) + sizeof(phdr);
+	phdr.p_filesz = notes;
+	phdr.p_align = 4;
+	want = phdr.p_offset + notes;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1) {
+		perror(path);
+		return TEST_FAIL;
+	}
+	ret = writev(fd, iov, n);
+	close(fd);
+	if (ret != want) {
+		if (ret < 0)
+			perror("writev");
+		else
+			printf("%s: short write, %zd of %zu\n", path, ret, want);
+		return TEST_FAIL;
+	}
+	return TEST_PASS;
+}
+
+int snapshot_core(pid_t child, const char *path)
+{
+	struct reg_snapshot snap;
+
+	if (snapshot_all(child, &snap))
+		return TEST_FAIL;
+	return snapshot_write_core(path, &snap, child);
+}
+
+void core_close(struct core_file *core)
+{
+	if (core->map)
+		munmap(core->map, core->size);
+	core->map = NULL;
+}
+
+int core_open(const char *path, struct core_file *core)
+{
+	const Elf64_Ehdr *ehdr;
+	const Elf64_Phdr *phdr;
+	struct stat st;
+	int fd, i;
+
+	memset(core, 0, sizeof(*core));
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		perror(path);
+		return TEST_FAIL;
+	}
+	if (fstat(fd, &st)) {
+		perror("fstat");
+		close(fd);
+		return TEST_FAIL;
+	}
+	core->size = st.st_size;
+	core->map = mmap(NULL, core->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (core->map == MAP_FAILED) {
+		perror("mmap");
+		core->map = NULL;
+		return TEST_FAIL;
+	}
+
+	ehdr = core->map;
+	if (core->size < sizeof(*ehdr) || memcmp(ehdr->e_ident, ELFMAG, SELFMAG) ||
+	    ehdr->e_ident[EI_CLASS] != ELFCLASS64 || ehdr->e_type != ET_CORE ||
+	    ehdr->e_phoff + ehdr->e_phnum * sizeof(*phdr) > core->size)
+		goto bad;
+
+	phdr = (const Elf64_Phdr *)((char *)core->map + ehdr->e_phoff);
+	for (i = 0; i < ehdr->e_phnum; i++) {
+		if (phdr[i].p_type != PT_NOTE)
+			continue;
+		if (phdr[i].p_offset + phdr[i].p_filesz > core->size)
+			goto bad;
+		core->notes = (char *)core->map + phdr[i].p_offset;
+		core->notes_size = phdr[i].p_filesz;
+		return TEST_PASS;
+	}
+bad:
+	printf("%s: not a core file with notes\n", path);
+	core_close(core);
+	return TEST_FAIL;
+}
+
+const void *core_note(const struct core_file *core, uint32_t type, size_t *len)
+{
+	const Elf64_Nhdr *nhdr;
+	size_t off = 0, desc;
+
+	while (off + sizeof(*nhdr) <= core->notes_size) {
+		nhdr = (const Elf64_Nhdr *)(core->notes + off);
+		desc = off + sizeof(*nhdr) + CORE_ALIGN(nhdr->n_namesz);
+		if (desc + nhdr->n_descsz > core->notes_size)
+			break;
+		if (nhdr->n_type == type) {
+			*len = nhdr->n_descsz;
+			return core->notes + desc;
+		}
+		off = desc + CORE_ALIGN(nhdr->n_descsz);
+	}
+	return NULL;
+}
+
+const void *core_regset(const struct core_file *core, unsigned long flag, size_t *len)
+{
+	unsigned int i = __builtin_ctzl(flag);
+	const char *note;
+
+	note = core_note(core, core_notes[i].type, len);
+	if (!note || *len < core_regset_offset(i))
+		return NULL;
+
+	*len -= core_regset_offset(i);
+	if (*len > snapshot_regsets[i].size)
+		*len = snapshot_regsets[i].size;
+	return note + core_regset_offset(i);
+}
+
+int core_snapshot(const struct core_file *core, struct reg_snapshot *snap)
+{
+	const struct snapshot_regset *r;
+	const void *regs;
+	unsigned int i;
+	size_t len;
+
+	memset(snap, 0, sizeof(*snap));
+	for (i = 0; i < ARRAY_SIZE(snapshot_regsets); i++) {
+		r = &snapshot_regsets[i];
+		regs = core_regset(core, r->flag, &len);
+		if (!regs)
+			continue;
+		memcpy((char *)snap + r->offset, regs, len);
+		snap->valid |= r->flag;
+	}
+	return snap->valid ? TEST_PASS : TEST_FAIL;
+}
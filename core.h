@@ -0,0 +1,117 @@
+/*
+ * Register snapshots as ELF core files
+ *
+ * snapshot_write_core() saves a struct reg_snapshot, running and
+ * checkpointed state, as a ppc64 ET_CORE file with one PT_NOTE segment
+ * holding a note per valid regset. Notes are typed and laid out as in
+ * a kernel core dump (NT_PRSTATUS, NT_PRFPREG and the NT_PPC_* numbers
+ * of <linux/elf.h>), so standard ELF tools can list and extract them.
+ * The whole file goes out in one writev().
+ *
+ * core_open() maps such a file and core_note() points straight into the
+ * mapping; core_snapshot() copies the notes back into a snapshot for the
+ * diff engine.
+ *
+ * Licensed under GPLv2.
+ */
+#ifndef _CORE_H
+#define _CORE_H
+
+#include "ptrace.h"
+
+#ifndef NT_PPC_VMX
+#define NT_PPC_VMX	0x100
+#endif
+#ifndef NT_PPC_VSX
+#define NT_PPC_VSX	0x102
+#endif
+
+/* ELF_NGREG: GPR notes carry struct pt_regs padded to 48 doublewords */
+#define CORE_NGREG	48
+
+/* struct elf_prstatus as a ppc64 kernel lays it out */
+struct core_prstatus {
+	int32_t		si_signo;
+	int32_t		si_code;
+	int32_t		si_errno;
+	int16_t		cursig;
+	uint64_t	sigpend;
+	uint64_t	sighold;
+	int32_t		pid;
+	int32_t		ppid;
+	int32_t		pgrp;
+	int32_t		sid;
+	uint64_t	times[8];	/* user, system, cuser, csystem */
+	uint64_t	reg[CORE_NGREG];
+	int32_t		fpvalid;
+};
+
+_Static_assert(offsetof(struct core_prstatus, reg) == 112 &&
+	       sizeof(struct core_prstatus) == 504, "ppc64 elf_prstatus layout");
+
+/* Indexed like snapshot_regsets[] */
+static const struct core_note {
+	uint32_t	type;
+	const char	*name;
+	size_t		size;		/* of the note, 0 for the regset's */
+} core_notes[] = {
+	{ NT_PRSTATUS,		"CORE",	sizeof(struct core_prstatus) },
+	{ NT_PRFPREG,		"CORE",	0 },
+	{ NT_PPC_VMX,		"LINUX", 0 },
+	{ NT_PPC_VSX,		"LINUX", 0 },
+	{ NT_PPC_TAR,		"LINUX", 0 },
+	{ NT_PPC_PPR,		"LINUX", 0 },
+	{ NT_PPC_DSCR,		"LINUX", 0 },
+	{ NT_PPC_EBB,		"LINUX", 0 },
+	{ NT_PPC_TM_SPR,	"LINUX", 0 },
+	{ NT_PPC_TM_CGPR,	"LINUX", CORE_NGREG * sizeof(unsigned long) },
+	{ NT_PPC_TM_CFPR,	"LINUX", 0 },
+	{ NT_PPC_TM_CVMX,	"LINUX", 0 },
+	{ NT_PPC_TM_CVSX,	"LINUX", 0 },
+	{ NT_PPC_TM_CTAR,	"LINUX", 0 },
+	{ NT_PPC_TM_CPPR,	"LINUX", 0 },
+	{ NT_PPC_TM_CDSCR,	"LINUX", 0 },
+	{ NT_PPC_PMU,		"LINUX", 0 },
+};
+
+_Static_assert(ARRAY_SIZE(core_notes) == ARRAY_SIZE(snapshot_regsets),
+	       "a note for every regset");
+
+#define CORE_ALIGN(x)	(((x) + 3) & ~3UL)
+
+static inline size_t core_note_size(unsigned int i)
+{
+	return core_notes[i].size ? core_notes[i].size : snapshot_regsets[i].size;
+}
+
+/* Where in the note the regset's bytes go */
+static inline size_t core_regset_offset(unsigned int i)
+{
+	return i ? 0 : offsetof(struct core_prstatus, reg);
+}
+
+int snapshot_write_core(const char *path, const struct reg_snapshot *snap, pid_t pid);
+
+/* Snapshot a stopped tracee straight to a core file */
+int snapshot_core(pid_t child, const char *path);
+
+struct core_file {
+	void *map;
+	size_t size;
+	const char *notes;		/* PT_NOTE contents */
+	size_t notes_size;
+};
+
+int core_open(const char *path, struct core_file *core);
+void core_close(struct core_file *core);
+
+/* First note of a type, in place in the mapping, or NULL */
+const void *core_note(const struct core_file *core, uint32_t type, size_t *len);
+
+/* The regset behind a SNAP_* flag, in place in the mapping, or NULL */
+const void *core_regset(const struct core_file *core, unsigned long flag, size_t *len);
+
+/* Copy every regset the file has into snap, for the diff engine */
+int core_snapshot(const struct core_file *core, struct reg_snapshot *snap);
+
+#endif /* _CORE_H */
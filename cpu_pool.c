@@ -0,0 +1,232 @@
+/*
+ * Topology aware CPU allocation
+ *
+ * Licensed under GPLv2.
+ */
+
+#define _GNU_SOURCE	/* For CPU_ZERO etc. */
+
+#include <dirent.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+
+#define SYSFS_CPU	"/sys/devices/system/cpu"
+
+static int read_sysfs_int(int cpu, const char *file, int def)
+{
+	char path[128];
+	FILE *f;
+	int val;
+
+	snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/topology/%s", cpu, file);
+	f = fopen(path, "r");
+	if (!f)
+		return def;
+	if (fscanf(f, "%d", &val) != 1)
+		val = def;
+	fclose(f);
+	return val;
+}
+
+static int read_node(int cpu)
+{
+	char path[64];
+	struct dirent *d;
+	int node = 0;
+	DIR *dir;
+
+	snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d", cpu);
+	dir = opendir(path);
+	if (!dir)
+		return 0;
+
+	while ((d = readdir(dir)))
+		if (sscanf(d->d_name, "node%d", &node) == 1)
+			break;
+	closedir(dir);
+	return node;
+}
+
+/*
+ * The first CPU of thread_siblings_list is the core's primary thread;
+ * it doubles as a system wide unique core number. The thread number is
+ * our position in that list.
+ */
+static void read_siblings(struct cpu_topo *t)
+{
+	char path[128], list[256], *p;
+	int first, last, thread = 0;
+	FILE *f;
+
+	t->core = t->cpu;
+	t->thread = 0;
+
+	snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/topology/thread_siblings_list", t->cpu);
+	f = fopen(path, "r");
+	if (!f)
+		return;
+	if (!fgets(list, sizeof(list), f)) {
+		fclose(f);
+		return;
+	}
+	fclose(f);
+
+	for (p = strtok(list, ","); p; p = strtok(NULL, ",")) {
+		if (sscanf(p, "%d-%d", &first, &last) != 2)
+			last = first = atoi(p);
+		if (thread == 0)
+			t->core = first;
+		if (t->cpu <= last) {
+			t->thread = thread + t->cpu - first;
+			return;
+		}
+		thread += last - first + 1;
+	}
+}
+
+/* Build the pool from the CPUs in our affinity mask */
+int cpu_pool_init(struct cpu_pool *pool)
+{
+	cpu_set_t mask;
+	int cpu;
+
+	memset(pool, 0, sizeof(*pool));
+	CPU_ZERO(&mask);
+
+	if (sched_getaffinity(0, sizeof(mask), &mask)) {
+		perror("sched_getaffinity");
+		return -1;
+	}
+
+	pool->cpus = calloc(CPU_COUNT(&mask), sizeof(*pool->cpus));
+	if (!pool->cpus) {
+		perror("calloc");
+		return -1;
+	}
+
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		struct cpu_topo *t;
+
+		if (!CPU_ISSET(cpu, &mask))
+			continue;
+
+		t = &pool->cpus[pool->nr++];
+		t->cpu = cpu;
+		t->socket = read_sysfs_int(cpu, "physical_package_id", 0);
+		t->node = read_node(cpu);
+		read_siblings(t);
+	}
+
+	return 0;
+}
+
+void cpu_pool_fini(struct cpu_pool *pool)
+{
+	free(pool->cpus);
+	pool->cpus = NULL;
+	pool->nr = 0;
+}
+
+enum cpu_scope { SCOPE_CORE, SCOPE_NODE, SCOPE_SOCKET };
+
+/* Number of busy CPUs sharing a core, a NUMA node or a socket with t */
+static int busy_on(struct cpu_pool *pool, struct cpu_topo *t, enum cpu_scope scope)
+{
+	struct cpu_topo *c;
+	int i, n = 0;
+
+	for (i = 0; i < pool->nr; i++) {
+		c = &pool->cpus[i];
+		if (!c->busy)
+			continue;
+		switch (scope) {
+		case SCOPE_CORE:
+			n += c->core == t->core;
+			break;
+		case SCOPE_NODE:
+			n += c->socket == t->socket && c->node == t->node;
+			break;
+		case SCOPE_SOCKET:
+			n += c->socket == t->socket;
+			break;
+		}
+	}
+	return n;
+}
+
+/*
+ * Lower is better. CPU 0's core comes last in every policy, it takes
+ * most of the interrupts. Ties go to the lowest CPU number, so a given
+ * sequence of calls always places tests the same way.
+ */
+static unsigned long cpu_score(struct cpu_pool *pool, struct cpu_topo *t,
+			       enum cpu_policy policy)
+{
+	unsigned long core_busy = busy_on(pool, t, SCOPE_CORE);
+	unsigned long boot = t->core == 0;
+
+	switch (policy) {
+	case CPU_SAME_CORE:
+		/* Fill up the busiest core before starting on a new one */
+		return ((255 - core_busy) << 24) | (boot << 16) | t->thread;
+	case CPU_CROSS_SOCKET:
+		/* Then over the NUMA nodes of a socket, on chips with several */
+		return ((unsigned long)busy_on(pool, t, SCOPE_SOCKET) << 48) |
+		       ((unsigned long)busy_on(pool, t, SCOPE_NODE) << 32) |
+		       (core_busy << 24) | (boot << 16) | t->thread;
+	case CPU_DISTINCT_CORES:
+	default:
+		return (core_busy << 24) | (boot << 16) | t->thread;
+	}
+}
+
+/* Hand out a free CPU according to policy, -1 if all are in use */
+int cpu_pool_alloc(struct cpu_pool *pool, enum cpu_policy policy)
+{
+	struct cpu_topo *best = NULL;
+	unsigned long score, best_score = 0;
+	int i;
+
+	for (i = 0; i < pool->nr; i++) {
+		if (pool->cpus[i].busy)
+			continue;
+		score = cpu_score(pool, &pool->cpus[i], policy);
+		if (!best || score < best_score) {
+			best = &pool->cpus[i];
+			best_score = score;
+		}
+	}
+
+	if (!best)
+		return -1;
+
+	best->busy = true;
+	return best->cpu;
+}
+
+void cpu_pool_free(struct cpu_pool *pool, int cpu)
+{
+	int i;
+
+	for (i = 0; i < pool->nr; i++)
+		if (pool->cpus[i].cpu == cpu)
+			pool->cpus[i].busy = false;
+}
+
+/* Policy name as accepted on command lines and in the environment */
+int cpu_policy_parse(const char *name, enum cpu_policy *policy)
+{
+	if (!strcmp(name, "cores"))
+		*policy = CPU_DISTINCT_CORES;
+	else if (!strcmp(name, "siblings"))
+		*policy = CPU_SAME_CORE;
+	else if (!strcmp(name, "sockets"))
+		*policy = CPU_CROSS_SOCKET;
+	else
+		return -1;
+	return 0;
+}
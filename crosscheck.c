@@ -0,0 +1,319 @@
+/*
+ * Differential check of the TM register views
+ *
+ * Every run loads random checkpointed and transactional values into
+ * r14-r23, the FPRs and the VSRs, suspends and stops at
+ * crosscheck_break_here(). The same registers are then collected four
+ * ways:
+ *
+ *   expected	what the run loaded
+ *   ptrace	the tracer's show_*(), handed back to the tracee
+ *   sigframe	the signal frame of sigframe_break() (sigframe.h)
+ *   self	store_gpr(), store_fpr() and storevsx() in the tracee, the
+ *		running values before the stop and the checkpointed ones
+ *		from the abort handler once the transaction failed
+ *
+ * and each view is diffed against the expected one with the snapshot
+ * diff engine of ptrace.h. Several tracer/tracee pairs run at once,
+ * each from its own seed; CROSSCHECK_SEED=<n> replays one.
+ *
+ * Licensed under GPLv2.
+ */
+#include <signal.h>
+
+#include "sigframe.h"
+#include "tracer.h"
+
+#define NGPR			10	/* r14-r23, as load_gpr() */
+#define CROSSCHECK_RUNS		1000	/* per tracee */
+#define CROSSCHECK_TRACEES	2
+#define CROSSCHECK_REPORTS	10	/* mismatching runs printed per tracee */
+
+extern void load_gpr(void *p);
+extern void store_gpr(void *p);
+extern void store_fpr(void *p);
+extern void loadvsx(void *p, int tmp);
+extern void storevsx(void *p, int tmp);
+
+/*
+ * In the formats of ptrace.S. Only loadvsx() loads: the FPRs are
+ * doubleword 0 of VSR0-31, so vsx[] carries fpr[] as doubles there.
+ */
+struct crosscheck_regs {
+	unsigned long gpr[NGPR];
+	float fpr[32];
+	unsigned long vsx[128];
+};
+
+struct crosscheck_regs crosscheck_load, crosscheck_load_ckpt;
+struct crosscheck_regs crosscheck_dump, crosscheck_dump_ckpt;
+
+/* Written by the tracer at every stop */
+struct reg_snapshot crosscheck_ptrace;
+
+#define CROSSCHECK_VALID	(SNAP_GPR | SNAP_FPR | SNAP_VSX | \
+				 SNAP_CGPR | SNAP_CFPR | SNAP_CVSX)
+
+static int runs = CROSSCHECK_RUNS;
+
+__attribute__((used)) void crosscheck_load_regs(void)
+{
+	load_gpr(crosscheck_load.gpr);
+	loadvsx(crosscheck_load.vsx, 0);
+}
+
+__attribute__((used)) void crosscheck_load_regs_ckpt(void)
+{
+	load_gpr(crosscheck_load_ckpt.gpr);
+	loadvsx(crosscheck_load_ckpt.vsx, 0);
+}
+
+__attribute__((used)) void crosscheck_dump_regs(void)
+{
+	store_gpr(crosscheck_dump.gpr);
+	storevsx(crosscheck_dump.vsx, 0);
+	store_fpr(crosscheck_dump.fpr);
+}
+
+__attribute__((used)) void crosscheck_dump_regs_ckpt(void)
+{
+	store_gpr(crosscheck_dump_ckpt.gpr);
+	storevsx(crosscheck_dump_ckpt.vsx, 0);
+	store_fpr(crosscheck_dump_ckpt.fpr);
+}
+
+__attribute__((used)) void crosscheck_break_here(void)
+{
+	sigframe_break();
+}
+
+/* Non zero if the transaction failed, as it must once stopped */
+static int crosscheck_cycle(void)
+{
+	unsigned long abort;
+
+	asm __volatile__(
+		"bl crosscheck_load_regs_ckpt;"
+
+		TBEGIN
+		"beq 1f;"
+
+		"bl crosscheck_load_regs;"
+		TSUSPEND
+		"bl crosscheck_dump_regs;"
+		"bl crosscheck_break_here;"
+		TRESUME
+
+		TEND
+		"li %[abrt], 0;"
+		"b 2f;"
+
+		/* Back to the checkpointed registers: dump them first */
+		"1: ;"
+		"bl crosscheck_dump_regs_ckpt;"
+		"li %[abrt], 1;"
+
+		"2: ;"
+		: [abrt] "=r" (abort)
+		:
+		: "memory",
+		"r14", "r15", "r16", "r17", "r18", "r19", "r20", "r21", "r22", "r23",
+		TM_CALL_CLOBBERS, TM_FPR_CLOBBERS, TM_VMX_CLOBBERS
+		);
+
+	return abort;
+}
+
+/* Any bits, but the FPRs get finite singles: stfs would not keep NaNs */
+static void crosscheck_randomize(struct crosscheck_regs *regs, unsigned long *state)
+{
+	double d;
+	int i;
+
+	for (i = 0; i < NGPR; i++)
+		regs->gpr[i] = xorshift64(state);
+	for (i = 0; i < 128; i++)
+		regs->vsx[i] = xorshift64(state);
+	for (i = 0; i < 32; i++) {
+		regs->fpr[i] = random_finite_single(state);
+		d = regs->fpr[i];
+		memcpy(&regs->vsx[2 * i], &d, sizeof(d));
+	}
+}
+
+/*
+ * One register file of a view: only the checked registers are filled,
+ * everything else stays zero so that the diff ignores it. fpr[] are
+ * the doubles the FPRs hold, vsx[] doubleword 1 of VSR0-31.
+ */
+static void crosscheck_view(struct reg_set *set, const unsigned long *gpr,
+			    const unsigned long *fpr, const unsigned long *vsx)
+{
+	memset(set, 0, sizeof(*set));
+	memcpy(&set->gpr.gpr[14], gpr, NGPR * sizeof(*gpr));
+	memcpy(set->fpr.fpr, fpr, 32 * sizeof(*fpr));
+	memcpy(set->vsx.vsr, vsx, 32 * sizeof(*vsx));
+}
+
+/* View of a struct crosscheck_regs, loaded or dumped */
+static void crosscheck_view_regs(struct reg_set *set, const struct crosscheck_regs *regs)
+{
+	unsigned long fpr[32], vsx[32];
+	double d;
+	int i;
+
+	for (i = 0; i < 32; i++) {
+		d = regs->fpr[i];
+		memcpy(&fpr[i], &d, sizeof(d));
+		vsx[i] = regs->vsx[2 * i + 1];
+	}
+	crosscheck_view(set, regs->gpr, fpr, vsx);
+}
+
+/* Tracer: capture the ptrace view at every stop and hand it over */
+static struct tracee_buf ptrace_view[] = {
+	{ "crosscheck_ptrace", &crosscheck_ptrace, sizeof(crosscheck_ptrace) },
+};
+
+static int crosscheck_stop(pid_t child, int hit, void *arg)
+{
+	unsigned long gpr[18], fpr[32], vsx[32];
+	unsigned long cgpr[18], cfpr[32], cvsx[32];
+
+	if (show_gpr(child, gpr) || show_fpr(child, fpr) || show_vsx(child, vsx) ||
+	    show_ckpt_gpr(child, cgpr) || show_ckpt_fpr(child, cfpr) ||
+	    show_vsx_ckpt(child, cvsx))
+		return TEST_FAIL;
+
+	crosscheck_view(&crosscheck_ptrace.live, gpr, fpr, vsx);
+	crosscheck_view(&crosscheck_ptrace.ckpt, cgpr, cfpr, cvsx);
+	crosscheck_ptrace.valid = CROSSCHECK_VALID;
+	return tracee_bufs_write(child, ptrace_view, ARRAY_SIZE(ptrace_view));
+}
+
+/* Tracee: diff every view against the expected one, 1 on a mismatch */
+static int crosscheck_compare(int run, const struct reg_snapshot *expected,
+			      const struct reg_snapshot *views, const char * const *names,
+			      int nr, bool report)
+{
+	static struct reg_diff live, ckpt;
+	char prefix[64];
+	int i, n, ret = 0;
+
+	for (i = 0; i < nr; i++) {
+		n = snapshot_diff(expected, &views[i], &live, &ckpt);
+		if (!n)
+			continue;
+		ret = 1;
+		if (!report)
+			continue;
+		printf("crosscheck: run %d: %s view differs in %d registers\n",
+		       run, names[i], n);
+		snprintf(prefix, sizeof(prefix), "crosscheck: %s", names[i]);
+		reg_diff_print(prefix, &live);
+		snprintf(prefix, sizeof(prefix), "crosscheck: %s ckpt", names[i]);
+		reg_diff_print(prefix, &ckpt);
+	}
+	return ret;
+}
+
+static void crosscheck_tracee(void)
+{
+	static const char * const names[] = { "ptrace", "sigframe", "self" };
+	static struct reg_snapshot expected, views[3], frame;
+	unsigned long seed, state;
+	int i, stops, failed = 0;
+	char *env;
+
+	env = getenv("CROSSCHECK_SEED");
+	seed = env ? strtoul(env, NULL, 0) : monotonic_ns() ^ getpid();
+	state = seed | 1;
+
+	for (i = 0; i < runs; i++) {
+		crosscheck_randomize(&crosscheck_load, &state);
+		crosscheck_randomize(&crosscheck_load_ckpt, &state);
+		crosscheck_ptrace.valid = 0;
+
+		if (sigframe_arm(&frame, 1))
+			exit(1);
+		if (!crosscheck_cycle()) {
+			sigframe_disarm();
+			printf("crosscheck: transaction survived the stop\n");
+			exit(1);
+		}
+		stops = sigframe_disarm();
+
+		if (stops != 1 || (crosscheck_ptrace.valid & CROSSCHECK_VALID) != CROSSCHECK_VALID ||
+		    (frame.valid & CROSSCHECK_VALID) != CROSSCHECK_VALID) {
+			printf("crosscheck: run %d: %d signals, ptrace %lx and sigframe %lx valid\n",
+			       i, stops, crosscheck_ptrace.valid, frame.valid);
+			exit(1);
+		}
+
+		crosscheck_view_regs(&expected.live, &crosscheck_load);
+		crosscheck_view_regs(&expected.ckpt, &crosscheck_load_ckpt);
+		expected.valid = CROSSCHECK_VALID;
+
+		views[0] = crosscheck_ptrace;
+		crosscheck_view(&views[1].live, &frame.live.gpr.gpr[14],
+				frame.live.fpr.fpr, frame.live.vsx.vsr);
+		crosscheck_view(&views[1].ckpt, &frame.ckpt.gpr.gpr[14],
+				frame.ckpt.fpr.fpr, frame.ckpt.vsx.vsr);
+		views[1].valid = CROSSCHECK_VALID;
+		crosscheck_view_regs(&views[2].live, &crosscheck_dump);
+		crosscheck_view_regs(&views[2].ckpt, &crosscheck_dump_ckpt);
+		views[2].valid = CROSSCHECK_VALID;
+
+		failed += crosscheck_compare(i, &expected, views, names, ARRAY_SIZE(names),
+					     failed < CROSSCHECK_REPORTS);
+	}
+
+	printf("crosscheck: tracee %d, seed %#lx: %d runs, %d mismatching\n",
+	       getpid(), seed, runs, failed);
+	exit(failed ? 1 : 0);
+}
+
+/* One tracer per tracee, all running at once */
+static int crosscheck(int tracees)
+{
+	int i, status, ret = TEST_PASS;
+	pid_t pid;
+
+	SKIP_IF(!cpu_caps.htm || !cpu_caps.vsx);
+
+	if (tracee_bufs_resolve(ptrace_view, ARRAY_SIZE(ptrace_view)))
+		return TEST_FAIL;
+
+	for (i = 0; i < tracees; i++) {
+		pid = fork();
+		if (pid == -1) {
+			perror("fork");
+			ret = TEST_FAIL;
+			break;
+		}
+		if (pid == 0)
+			exit(trace_breakpoints("crosscheck", crosscheck_tracee,
+					       "crosscheck_break_here", crosscheck_stop, NULL));
+	}
+
+	while (wait(&status) != -1)
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+			ret = TEST_FAIL;
+	return ret;
+}
+
+static int crosscheck_default(void)
+{
+	return crosscheck(CROSSCHECK_TRACEES);
+}
+
+/* -n runs in total, spread over -t tracees */
+static int crosscheck_stress(struct tm_stress_opts *opts)
+{
+	runs = opts->cycles / opts->threads;
+	if (runs < 1)
+		runs = 1;
+	return crosscheck(opts->threads);
+}
+
+TEST_REGISTER_STRESS(crosscheck_default, "crosscheck", crosscheck_stress);
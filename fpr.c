@@ -1,86 +1,110 @@
-#include "ptrace.h"
-#define VEC_MAX 32
+#include "tm_spd.h"
+#include "sigframe.h"
+#include "tracer.h"
 
-extern void load_fpr(void *p);
+#define VEC_MAX 32
+#define FPR_WRITE 1.5
 
 float fp_load[VEC_MAX];
 float fp_load_new[VEC_MAX];
 float fp_load_ckpt[VEC_MAX];
 
-__attribute__((used)) void load(void)
-{
-	load_fpr(fp_load);
-}
+static struct tm_spd fpr_spd = TM_SPD(TM_SPD_FPR, fp_load, fp_load_new, fp_load_ckpt);
 
-__attribute__((used)) void load_new(void)
+/* The FPRs hold the single precision loads as doubles */
+static void fpr_image(const float *f, unsigned long *fpr)
 {
-	load_fpr(fp_load_new);
+	double d;
+	int i;
+
+	for (i = 0; i < VEC_MAX; i++) {
+		d = f[i];
+		memcpy(&fpr[i], &d, sizeof(d));
+	}
 }
 
-__attribute__((used)) void load_ckpt(void)
+/* The tracee's copies of the arrays, read at every stop */
+static float tracee_load[VEC_MAX], tracee_ckpt[VEC_MAX];
+
+static struct tracee_buf loads[] = {
+	{ "fp_load", tracee_load, sizeof(tracee_load) },
+	{ "fp_load_ckpt", tracee_ckpt, sizeof(tracee_ckpt) },
+};
+
+/*
+ * At tm_spd_break_here: the FPRs hold fp_load and their checkpoint
+ * fp_load_ckpt. The live values are thrown away on TRESUME, so they
+ * can be rewritten.
+ */
+static int check_break(pid_t child, int hit, void *arg)
 {
-	load_fpr(fp_load_ckpt);
+	unsigned long fpr[VEC_MAX], want[VEC_MAX];
+	float written[VEC_MAX];
+	int i;
+
+	if (tracee_bufs_read(child, loads, ARRAY_SIZE(loads)))
+		return TEST_FAIL;
+
+	fpr_image(tracee_load, want);
+	if (show_fpr(child, fpr) || tracer_expect("fpr", fpr, want, VEC_MAX))
+		return TEST_FAIL;
+	fpr_image(tracee_ckpt, want);
+	if (show_ckpt_fpr(child, fpr) || tracer_expect("ckpt fpr", fpr, want, VEC_MAX))
+		return TEST_FAIL;
+
+	for (i = 0; i < VEC_MAX; i++)
+		written[i] = FPR_WRITE;
+	fpr_image(written, want);
+	if (write_fpr(child, want[0]) || show_fpr(child, fpr) ||
+	    tracer_expect("written fpr", fpr, want, VEC_MAX))
+		return TEST_FAIL;
+	return TEST_PASS;
 }
 
-__attribute__((used)) void break_here(void)
+static tm_cycle_t fpr_init(void)
 {
-	//breakpoint;
+	tm_spd_fill(&fpr_spd, TM_SPD_FILL_CONST, 0);
+	return tm_spd_select(&fpr_spd);
 }
 
-void tm_spd(void)
+static int ptrace_fpr(void)
 {
-	unsigned long abort, texasr;
-
-	asm __volatile__(
-		"bl load_ckpt;"
-
-		"1: ;"
-		TBEGIN
-		"beq 2f;"
-
-		"bl load_new;"
-		TSUSPEND
-		"bl load;"
-		"bl break_here;"
-		TRESUME
-
-		TEND
-		"li 0, 0;"
-		"ori %[abrt], 0, 0;"
-		"b 3f;"
-
-		"2: ;"
-		"li 0, 1;"
-		"ori %[abrt], 0, 0;"
-		"mfspr %[texasr], %[sprn_texasr];"
-
-		"3: ;"
-		: [abrt] "=r" (abort), [texasr] "=r" (texasr)
-		: [fp_load] "r" (fp_load), [fp_load_ckpt] "r" (fp_load_ckpt), [sprn_texasr] "i"  (SPRN_TEXASR)
-		: "memory"
-		);
-
-	if (abort)
-	  {
-	    printf("failed transaction (texasr %lx)\n", texasr);
-	    exit(1);
-	  }
-	exit(0);
+	SKIP_IF(!cpu_caps.htm);
+
+	fpr_init();
+	if (tracee_bufs_resolve(loads, ARRAY_SIZE(loads)))
+		return TEST_FAIL;
+	return trace_breakpoints("fpr", tm_spd_tracee, "tm_spd_break_here", check_break, NULL);
 }
 
-int main(int argc, char *argv[])
+static int ptrace_fpr_stress(struct tm_stress_opts *opts)
 {
-	int i;
+	SKIP_IF(!cpu_caps.htm);
 
-	SKIP_IF(!((long)get_auxv_entry(AT_HWCAP2) & PPC_FEATURE2_HTM));
+	return tm_stress("fpr", fpr_init(), opts);
+}
 
-	for(i = 0; i < VEC_MAX; i++) {
-		fp_load[i] = 0.1;
-		fp_load_new[i] = 0.2;
-		fp_load_ckpt[i] = 0.3;
-	}
+TEST_REGISTER_STRESS(ptrace_fpr, "fpr", ptrace_fpr_stress);
 
-	tm_spd();
+/* Same as check_break(), against the FPRs saved in the signal frame */
+static int check_frame(const struct reg_snapshot *snap, void *arg)
+{
+	unsigned long want[VEC_MAX];
+
+	fpr_image(fp_load, want);
+	if (tracer_expect("fpr", snap->live.fpr.fpr, want, VEC_MAX))
+		return TEST_FAIL;
+	fpr_image(fp_load_ckpt, want);
+	if (tracer_expect("ckpt fpr", snap->ckpt.fpr.fpr, want, VEC_MAX))
+		return TEST_FAIL;
+	return TEST_PASS;
+}
 
-	return 0;
+static int sigframe_fpr(void)
+{
+	SKIP_IF(!cpu_caps.htm);
+
+	return sigframe_run("fpr_sigframe", fpr_init(), SIGFRAME_RUNS, check_frame, NULL);
 }
+
+TEST_REGISTER(sigframe_fpr, "fpr_sigframe");
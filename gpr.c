@@ -1,89 +1,90 @@
-#include "ptrace.h"
-#define VEC_MAX 10
+#include "tm_spd.h"
+#include "sigframe.h"
+#include "tracer.h"
 
-extern void load_gpr(void *p);
+#define VEC_MAX 10
+#define GPR_WRITE 0xdeadbeefUL
 
 unsigned long gp_load[VEC_MAX];
 unsigned long gp_load_new[VEC_MAX];
 unsigned long gp_load_ckpt[VEC_MAX];
 
-__attribute__((used)) void load(void)
+static struct tm_spd gpr_spd = TM_SPD(TM_SPD_GPR, gp_load, gp_load_new, gp_load_ckpt);
+
+/* The tracee's copies of the arrays, read at every stop */
+static unsigned long tracee_load[VEC_MAX], tracee_ckpt[VEC_MAX];
+
+static struct tracee_buf loads[] = {
+	{ "gp_load", tracee_load, sizeof(tracee_load) },
+	{ "gp_load_ckpt", tracee_ckpt, sizeof(tracee_ckpt) },
+};
+
+/*
+ * At tm_spd_break_here: r14-r23 hold gp_load and their checkpoint
+ * gp_load_ckpt. The live values are thrown away on TRESUME, so they
+ * can be rewritten.
+ */
+static int check_break(pid_t child, int hit, void *arg)
 {
-	load_gpr(gp_load);
+	unsigned long gpr[18], want[18];
+	int i;
+
+	if (tracee_bufs_read(child, loads, ARRAY_SIZE(loads)))
+		return TEST_FAIL;
+
+	if (show_gpr(child, gpr) || tracer_expect("gpr", gpr, tracee_load, VEC_MAX))
+		return TEST_FAIL;
+	if (show_ckpt_gpr(child, gpr) ||
+	    tracer_expect("ckpt gpr", gpr, tracee_ckpt, VEC_MAX))
+		return TEST_FAIL;
+
+	for (i = 0; i < 18; i++)
+		want[i] = GPR_WRITE;
+	if (write_gpr(child, GPR_WRITE) || show_gpr(child, gpr) ||
+	    tracer_expect("written gpr", gpr, want, 18))
+		return TEST_FAIL;
+	return TEST_PASS;
 }
 
-__attribute__((used)) void load_new(void)
+static tm_cycle_t gpr_init(void)
 {
-	load_gpr(gp_load_new);
+	tm_spd_fill(&gpr_spd, TM_SPD_FILL_INDEX, 0);
+	return tm_spd_select(&gpr_spd);
 }
 
-__attribute__((used)) void load_ckpt(void)
+static int ptrace_gpr(void)
 {
-	load_gpr(gp_load_ckpt);
+	SKIP_IF(!cpu_caps.htm);
+
+	gpr_init();
+	if (tracee_bufs_resolve(loads, ARRAY_SIZE(loads)))
+		return TEST_FAIL;
+	return trace_breakpoints("gpr", tm_spd_tracee, "tm_spd_break_here", check_break, NULL);
 }
 
-__attribute__((used)) void break_here(void)
+static int ptrace_gpr_stress(struct tm_stress_opts *opts)
 {
-	//while(!cptr[1]);
+	SKIP_IF(!cpu_caps.htm);
+
+	return tm_stress("gpr", gpr_init(), opts);
 }
 
-void tm_spd(void)
+TEST_REGISTER_STRESS(ptrace_gpr, "gpr", ptrace_gpr_stress);
+
+/* Signal frame: live r14-r23 from gp_load, checkpointed from gp_load_ckpt */
+static int check_frame(const struct reg_snapshot *snap, void *arg)
 {
-	unsigned long abort, texasr;
-
-	asm __volatile__(
-		"bl load_ckpt;"
-
-		"1: ;"
-		TBEGIN
-		"beq 2f;"
-
-		"bl load_new;"
-		TSUSPEND
-		"bl load;"
-		"bl break_here;"
-		TRESUME
-
-		TEND
-		"li 0, 0;"
-		"ori %[abrt], 0, 0;"
-		"b 3f;"
-
-		// transaction abort handler
-		"2: ;"
-		"li 0, 1;"
-		"ori %[abrt], 0, 0;"
-		"mfspr %[texasr], %[sprn_texasr];"
-
-		"3: ;"
-		: [abrt] "=r" (abort), [texasr] "=r" (texasr)
-		: [gp_load] "r" (gp_load), [gp_load_ckpt] "r" (gp_load_ckpt), [sprn_texasr] "i"  (SPRN_TEXASR)
-		: "memory", "r0", "r1", "r2", "r3", "r4", "r8", "r9", "r10", "r11", "r12", "r13",
-		"r14", "r15", "r16", "r17", "r18", "r19", "r20", "r21", "r22", "r23"
-		);
-
-	if (abort)
-	  {
-	    printf("failed transaction (texasr %lx)\n", texasr);
-	    exit(1);
-	  }
-	printf("successfull transaction (texasr %lx)\n", texasr);
-	exit(0);
+	if (tracer_expect("gpr", &snap->live.gpr.gpr[14], gp_load, VEC_MAX) ||
+	    tracer_expect("ckpt gpr", &snap->ckpt.gpr.gpr[14], gp_load_ckpt, VEC_MAX))
+		return TEST_FAIL;
+	return TEST_PASS;
 }
 
-int main(int argc, char *argv[])
+static int sigframe_gpr(void)
 {
-	int i;
-
-	SKIP_IF(!((long)get_auxv_entry(AT_HWCAP2) & PPC_FEATURE2_HTM));
+	SKIP_IF(!cpu_caps.htm);
 
-	for(i = 0; i < VEC_MAX; i++) {
-		gp_load[i] = 1 + i;
-		gp_load_new[i] = 2 * (1 + i);
-		gp_load_ckpt[i] = 3 * (1 + i);
-	}
-
-	tm_spd();
-
-	return 0;
+	return sigframe_run("gpr_sigframe", gpr_init(), SIGFRAME_RUNS, check_frame, NULL);
 }
+
+TEST_REGISTER(sigframe_gpr, "gpr_sigframe");
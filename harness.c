@@ -3,18 +3,31 @@
  * Licensed under GPLv2.
  */
 
+#define _GNU_SOURCE	/* For CPU_ZERO etc. */
+
 #include <errno.h>
+#include <stdarg.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
 #include <elf.h>
 #include <fcntl.h>
 #include <link.h>
+#include <sched.h>
+#include <time.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
 
 #include "subunit.h"
 #include "utils.h"
@@ -22,62 +35,304 @@
 #define TIMEOUT		120
 #define KILL_TIMEOUT	5
 
+#ifndef __NR_pidfd_open
+#define __NR_pidfd_open	434
+#endif
 
-int run_test(int (test_function)(void), char *name)
-{
-	bool terminated;
-	int rc, status;
+/*
+ * Child supervision
+ *
+ * Every test child is watched through a pidfd and has its own timerfd
+ * deadline, all multiplexed on one epoll instance, so a single thread
+ * can supervise any number of children without SIGALRM. On expiry the
+ * child's process group gets SIGTERM, then SIGKILL KILL_TIMEOUT seconds
+ * later. Kernels without pidfd_open() fall back to a SIGCHLD signalfd.
+ */
+struct test_job {
+	int (*function)(void);
+	char *name;
 	pid_t pid;
+	int cpu;
+	int pidfd;
+	int timerfd;
+	int kills;	/* signals sent so far: SIGTERM, then SIGKILL */
+	int status;
+	u64 fork_ns;
+	u64 end_ns;
+	struct rusage ru;
+	struct test_stats *stats;	/* shared with the child */
+	bool capture;			/* stdout/stderr collected in out */
+	int outfd;
+	struct subunit_buf out;
+};
 
-	/* Make sure output is flushed before forking */
-	fflush(stdout);
+struct supervisor {
+	int epfd;
+	int sigfd;	/* SIGCHLD signalfd, -1 when pidfds are available */
+	sigset_t oldmask;
+};
 
-	pid = fork();
-	if (pid == 0) {
-		setpgid(0, 0);
-		exit(test_function());
-	} else if (pid == -1) {
-		perror("fork");
+/* Low bits of the epoll data: which of the job's fds fired */
+#define EV_TIMER	1UL
+#define EV_OUTPUT	2UL
+#define EV_MASK		(EV_TIMER | EV_OUTPUT)
+
+/*
+ * SUBUNIT_FORMAT=v2 switches to the binary subunit v2 stream. Test
+ * output is then collected through a pipe and sent along with the
+ * result in one write, so no stdio buffer is shared with the children.
+ */
+static bool subunit_v2;
+
+static void harness_init_format(void)
+{
+	char *env = getenv("SUBUNIT_FORMAT");
+
+	subunit_v2 = env && !strcmp(env, "v2");
+}
+
+/* Harness messages about a job go along with its captured output */
+static void job_note(struct test_job *job, const char *fmt, ...)
+{
+	char msg[256];
+	va_list ap;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(msg, sizeof(msg), fmt, ap);
+	va_end(ap);
+
+	if (job->capture)
+		subunit_buf_append(&job->out, msg, len < sizeof(msg) ? len : sizeof(msg) - 1);
+	else
+		fputs(msg, stdout);
+}
+
+static int supervisor_init(struct supervisor *sv)
+{
+	struct epoll_event ev = { .events = EPOLLIN, .data.u64 = 0 };
+	sigset_t mask;
+	int fd;
+
+	sv->sigfd = -1;
+	sv->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (sv->epfd == -1) {
+		perror("epoll_create1");
 		return 1;
 	}
 
-	setpgid(pid, pid);
+	fd = syscall(__NR_pidfd_open, getpid(), 0);
+	if (fd >= 0) {
+		close(fd);
+		return 0;
+	}
 
-	/* Wake us up in timeout seconds */
-	alarm(TIMEOUT);
-	terminated = false;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &mask, &sv->oldmask);
 
-wait:
-	rc = waitpid(pid, &status, 0);
-	if (rc == -1) {
-		if (errno != EINTR) {
-			printf("unknown error from waitpid\n");
+	sv->sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (sv->sigfd == -1 || epoll_ctl(sv->epfd, EPOLL_CTL_ADD, sv->sigfd, &ev)) {
+		perror("signalfd");
+		return 1;
+	}
+	return 0;
+}
+
+static void supervisor_fini(struct supervisor *sv)
+{
+	if (sv->sigfd != -1) {
+		close(sv->sigfd);
+		sigprocmask(SIG_SETMASK, &sv->oldmask, NULL);
+	}
+	close(sv->epfd);
+}
+
+static int arm_timer(int fd, int seconds)
+{
+	struct itimerspec its = { .it_value.tv_sec = seconds };
+
+	return timerfd_settime(fd, 0, &its, NULL);
+}
+
+static int supervise(struct supervisor *sv, struct test_job *job)
+{
+	struct epoll_event ev = { .events = EPOLLIN };
+
+	job->kills = 0;
+	job->pidfd = -1;
+	job->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (job->timerfd == -1 || arm_timer(job->timerfd, TIMEOUT)) {
+		perror("timerfd");
+		return 1;
+	}
+	ev.data.u64 = (uintptr_t)job | EV_TIMER;
+	if (epoll_ctl(sv->epfd, EPOLL_CTL_ADD, job->timerfd, &ev)) {
+		perror("epoll_ctl");
+		return 1;
+	}
+
+	if (job->outfd != -1) {
+		ev.data.u64 = (uintptr_t)job | EV_OUTPUT;
+		if (epoll_ctl(sv->epfd, EPOLL_CTL_ADD, job->outfd, &ev)) {
+			perror("epoll_ctl");
 			return 1;
 		}
+	}
 
-		if (terminated) {
-			printf("!! force killing %s\n", name);
-			kill(-pid, SIGKILL);
-			return 1;
-		} else {
-			printf("!! killing %s\n", name);
-			kill(-pid, SIGTERM);
-			terminated = true;
-			alarm(KILL_TIMEOUT);
-			goto wait;
+	if (sv->sigfd != -1)
+		return 0;
+
+	job->pidfd = syscall(__NR_pidfd_open, job->pid, 0);
+	ev.data.u64 = (uintptr_t)job;
+	if (job->pidfd == -1 || epoll_ctl(sv->epfd, EPOLL_CTL_ADD, job->pidfd, &ev)) {
+		perror("pidfd_open");
+		return 1;
+	}
+	return 0;
+}
+
+/* Pull what is available from the output pipe, false once at EOF */
+static bool read_output(struct test_job *job)
+{
+	char buf[4096];
+	ssize_t n;
+
+	for (;;) {
+		n = read(job->outfd, buf, sizeof(buf));
+		if (n > 0) {
+			subunit_buf_append(&job->out, buf, n);
+			continue;
 		}
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n == -1 && errno == EAGAIN)
+			return true;
+
+		close(job->outfd);
+		job->outfd = -1;
+		return false;
+	}
+}
+
+static void unsupervise(struct test_job *job)
+{
+	job->end_ns = monotonic_ns();
+
+	/* Whatever the child wrote before exiting is in the pipe by now */
+	if (job->outfd != -1) {
+		read_output(job);
+		if (job->outfd != -1)
+			close(job->outfd);
+		job->outfd = -1;
 	}
 
+	/* Closing the fds also drops them from the epoll set */
+	close(job->timerfd);
+	if (job->pidfd != -1)
+		close(job->pidfd);
+}
+
+/* Deadline hit: escalate, or give up if even SIGKILL did not help */
+static bool escalate(struct test_job *job)
+{
+	uint64_t expirations;
+
+	if (read(job->timerfd, &expirations, sizeof(expirations)) < 0)
+		return false;
+
+	switch (job->kills++) {
+	case 0:
+		job_note(job, "!! killing %s\n", job->name);
+		kill(-job->pid, SIGTERM);
+		break;
+	case 1:
+		job_note(job, "!! force killing %s\n", job->name);
+		kill(-job->pid, SIGKILL);
+		break;
+	default:
+		return true;
+	}
+	arm_timer(job->timerfd, KILL_TIMEOUT);
+	return false;
+}
+
+/*
+ * Wait for the next of the nr jobs (pid 0 entries are idle) to finish,
+ * handling deadlines on the way. Returns it with its wait status, or
+ * NULL on error.
+ */
+static struct test_job *supervise_wait(struct supervisor *sv,
+				       struct test_job *jobs, int nr)
+{
+	struct epoll_event events[16];
+	struct signalfd_siginfo si;
+	struct test_job *job;
+	int i, n;
+
+	for (;;) {
+		if (sv->sigfd != -1) {
+			while (read(sv->sigfd, &si, sizeof(si)) > 0)
+				;
+			for (i = 0; i < nr; i++) {
+				if (jobs[i].pid &&
+				    wait4(jobs[i].pid, &jobs[i].status, WNOHANG, &jobs[i].ru) > 0) {
+					unsupervise(&jobs[i]);
+					return &jobs[i];
+				}
+			}
+		}
+
+		n = epoll_wait(sv->epfd, events, 16, -1);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			perror("epoll_wait");
+			return NULL;
+		}
+
+		for (i = 0; i < n; i++) {
+			if (!events[i].data.u64)
+				continue;	/* SIGCHLD, scanned above */
+
+			job = (struct test_job *)(uintptr_t)(events[i].data.u64 & ~EV_MASK);
+			if (events[i].data.u64 & EV_OUTPUT) {
+				/* At EOF the pipe is closed, leaving the epoll set */
+				read_output(job);
+				continue;
+			} else if (events[i].data.u64 & EV_TIMER) {
+				if (!escalate(job))
+					continue;
+				/* Unkillable, report it and leave the zombie */
+				job->status = -1;
+			} else if (wait4(job->pid, &job->status, 0, &job->ru) != job->pid) {
+				perror("wait4");
+				job->status = -1;
+			}
+			unsupervise(job);
+			return job;
+		}
+	}
+}
+
+/* Decode the exit status of a finished test child */
+static int reap_test(struct test_job *job)
+{
+	int status = job->status;
+
 	/* Kill anything else in the process group that is still running */
-	kill(-pid, SIGTERM);
+	kill(-job->pid, SIGTERM);
+
+	if (status == -1)
+		return 1;
 
 	if (WIFEXITED(status))
 		status = WEXITSTATUS(status);
 	else {
 		if (WIFSIGNALED(status))
-			printf("!! child died by signal %d\n", WTERMSIG(status));
+			job_note(job, "!! child died by signal %d\n", WTERMSIG(status));
 		else
-			printf("!! child died by unknown cause\n");
+			job_note(job, "!! child died by unknown cause\n");
 
 		status = 1; /* Signal or other */
 	}
@@ -85,34 +340,332 @@ wait:
 	return status;
 }
 
-static void alarm_handler(int signum)
+static void release_stats(struct test_job *job)
 {
-	/* Jut wake us up from waitpid */
+	if (job->stats)
+		munmap(job->stats, sizeof(*job->stats));
+	job->stats = NULL;
 }
 
-static struct sigaction alarm_action = {
-	.sa_handler = alarm_handler,
-};
+static u64 timeval_us(struct timeval *tv)
+{
+	return tv->tv_sec * 1000000ULL + tv->tv_usec;
+}
 
-int test_harness(int (test_function)(void), char *name)
+/*
+ * Resource usage and timing of a finished job, as space separated
+ * subunit tags. The child runs the test body straight after fork()
+ * without an exec, so fork_us is the fork to test start latency.
+ */
+static void format_stats(struct test_job *job, char *tags, size_t size)
 {
-	int rc;
+	int len;
 
-	test_start(name);
-	test_set_git_version(GIT_VERSION);
+	len = snprintf(tags, size,
+		       "wall_us:%llu utime_us:%llu stime_us:%llu maxrss_kb:%ld "
+		       "nvcsw:%ld nivcsw:%ld",
+		       (job->end_ns - job->fork_ns) / 1000,
+		       timeval_us(&job->ru.ru_utime), timeval_us(&job->ru.ru_stime),
+		       job->ru.ru_maxrss, job->ru.ru_nvcsw, job->ru.ru_nivcsw);
 
-	if (sigaction(SIGALRM, &alarm_action, NULL)) {
-		perror("sigaction");
-		test_error(name);
-		return 1;
+	if (job->stats && job->stats->start_ns)
+		len += snprintf(tags + len, size - len, " fork_us:%llu",
+				(job->stats->start_ns - job->fork_ns) / 1000);
+	if (job->stats && job->stats->first_stop_ns)
+		snprintf(tags + len, size - len, " first_stop_us:%llu",
+			 (job->stats->first_stop_ns - job->fork_ns) / 1000);
+}
+
+static void write_all(int fd, const void *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len) {
+		n = write(fd, buf, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("write");
+			return;
+		}
+		buf = (const char *)buf + n;
+		len -= n;
+	}
+}
+
+/* The whole record of a job as one subunit v2 write */
+static void report_v2(struct test_job *job, int rc, char *stats)
+{
+	char git_version[128], *tags[16], *tok, *save;
+	struct subunit_buf pkt = { 0 };
+	int status, nr = 0;
+
+	snprintf(git_version, sizeof(git_version), "git_version:%s", GIT_VERSION);
+	tags[nr++] = git_version;
+	for (tok = strtok_r(stats, " ", &save); tok && nr < ARRAY_SIZE(tags) - 1;
+	     tok = strtok_r(NULL, " ", &save))
+		tags[nr++] = tok;
+	tags[nr] = NULL;
+
+	if (rc == MAGIC_SKIP_RETURN_VALUE)
+		status = SUBUNIT_SKIP;
+	else
+		status = rc ? SUBUNIT_FAIL : SUBUNIT_SUCCESS;
+
+	if (!subunit_v2_event(&pkt, job->name, SUBUNIT_INPROGRESS, NULL, NULL, NULL, 0) &&
+	    !subunit_v2_event(&pkt, job->name, status, tags,
+			      job->out.len ? "stdout" : NULL, job->out.data, job->out.len))
+		write_all(STDOUT_FILENO, pkt.data, pkt.len);
+	else
+		fprintf(stderr, "!! out of memory reporting %s\n", job->name);
+
+	subunit_buf_free(&pkt);
+}
+
+/*
+ * Report a finished (or never started, pid 0) job. With started set,
+ * the text test: and git_version records were printed before it ran.
+ */
+static void report_job(struct test_job *job, int rc, bool started)
+{
+	char stats[256] = "";
+
+	if (job->pid)
+		format_stats(job, stats, sizeof(stats));
+	release_stats(job);
+
+	if (subunit_v2) {
+		report_v2(job, rc, stats);
+		subunit_buf_free(&job->out);
+		return;
 	}
 
-	rc = run_test(test_function, name);
+	if (!started) {
+		test_start(job->name);
+		test_set_git_version(GIT_VERSION);
+	}
+	if (job->pid)
+		test_set_tags(stats);
+	if (job->out.len)
+		fwrite(job->out.data, 1, job->out.len, stdout);
+	subunit_buf_free(&job->out);
 
 	if (rc == MAGIC_SKIP_RETURN_VALUE)
-		test_skip(name);
+		test_skip(job->name);
 	else
-		test_finish(name, rc);
+		test_finish(job->name, rc);
+	fflush(stdout);
+}
+
+/* Fork a test child, pinned to a CPU from pool unless pool is NULL */
+static int start_job(struct supervisor *sv, struct test_job *job,
+		     struct cpu_pool *pool, enum cpu_policy policy)
+{
+	int pipefd[2] = { -1, -1 };
+	cpu_set_t mask;
+	pid_t pid;
+
+	job->cpu = -1;
+	job->outfd = -1;
+	if (job->capture && pipe2(pipefd, O_CLOEXEC)) {
+		perror("pipe2");
+		return 1;
+	}
+	memset(&job->ru, 0, sizeof(job->ru));
+	job->stats = mmap(NULL, sizeof(*job->stats), PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (job->stats == MAP_FAILED)
+		job->stats = NULL;
+
+	if (pool)
+		job->cpu = cpu_pool_alloc(pool, policy);
+
+	/* Make sure output is flushed before forking */
+	fflush(stdout);
+
+	job->fork_ns = monotonic_ns();
+	pid = fork();
+	if (pid == 0) {
+		if (job->capture) {
+			dup2(pipefd[1], STDOUT_FILENO);
+			dup2(pipefd[1], STDERR_FILENO);
+		}
+		test_stats = job->stats;
+		if (test_stats)
+			test_stats->start_ns = monotonic_ns();
+		setpgid(0, 0);
+		if (sv->sigfd != -1)
+			sigprocmask(SIG_SETMASK, &sv->oldmask, NULL);
+		if (job->cpu >= 0) {
+			CPU_ZERO(&mask);
+			CPU_SET(job->cpu, &mask);
+			if (sched_setaffinity(0, sizeof(mask), &mask))
+				perror("sched_setaffinity");
+		}
+		exit(job->function());
+	} else if (pid == -1) {
+		perror("fork");
+		if (pool)
+			cpu_pool_free(pool, job->cpu);
+		release_stats(job);
+		if (job->capture) {
+			close(pipefd[0]);
+			close(pipefd[1]);
+		}
+		return 1;
+	}
+
+	setpgid(pid, pid);
+	job->pid = pid;
+
+	if (job->capture) {
+		close(pipefd[1]);
+		job->outfd = pipefd[0];
+		fcntl(job->outfd, F_SETFL, O_NONBLOCK);
+	}
+
+	if (supervise(sv, job)) {
+		kill(-pid, SIGKILL);
+		waitpid(pid, NULL, 0);
+		unsupervise(job);
+		job->pid = 0;
+		if (pool)
+			cpu_pool_free(pool, job->cpu);
+		release_stats(job);
+		return 1;
+	}
+	return 0;
+}
+
+/* Run one test child to completion under its own supervisor */
+static int run_job(struct test_job *job)
+{
+	struct supervisor sv;
+	int rc = 1;
+
+	if (supervisor_init(&sv))
+		return 1;
+
+	if (!start_job(&sv, job, NULL, 0)) {
+		if (supervise_wait(&sv, job, 1))
+			rc = reap_test(job);
+		else
+			printf("unknown error from waitpid\n");
+	}
+
+	supervisor_fini(&sv);
+	return rc;
+}
+
+int run_test(int (test_function)(void), char *name)
+{
+	struct test_job job = { .function = test_function, .name = name };
+	int rc;
+
+	rc = run_job(&job);
+	release_stats(&job);
+	return rc;
+}
+
+int test_harness(int (test_function)(void), char *name)
+{
+	struct test_job job = { .function = test_function, .name = name };
+	int rc;
+
+	harness_init_format();
+	job.capture = subunit_v2;
+
+	if (!subunit_v2) {
+		test_start(name);
+		test_set_git_version(GIT_VERSION);
+	}
+
+	rc = run_job(&job);
+	report_job(&job, rc, !subunit_v2);
 
 	return rc;
 }
+
+/*
+ * Job server mode: keep up to jobs tests in flight, each pinned to its
+ * own CPU. HARNESS_CPU_POLICY picks how CPUs are handed out: "cores"
+ * (default), "siblings" or "sockets". Output of each test is captured
+ * and reported together with its result when it finishes.
+ */
+int test_harness_parallel(struct harness_test *tests, int nr, int jobs)
+{
+	int i, rc, running = 0, next = 0, failed = 0;
+	struct test_job *slots, *job;
+	enum cpu_policy policy = CPU_DISTINCT_CORES;
+	struct supervisor sv;
+	struct cpu_pool pool;
+	char *env;
+
+	harness_init_format();
+
+	env = getenv("HARNESS_CPU_POLICY");
+	if (env && cpu_policy_parse(env, &policy))
+		printf("!! unknown HARNESS_CPU_POLICY %s, using cores\n", env);
+
+	/* One CPU per job */
+	if (cpu_pool_init(&pool))
+		return 1;
+	if (jobs <= 0 || jobs > pool.nr)
+		jobs = pool.nr;
+	if (jobs > nr)
+		jobs = nr;
+
+	slots = calloc(jobs, sizeof(*slots));
+	if (!slots) {
+		perror("calloc");
+		cpu_pool_fini(&pool);
+		return 1;
+	}
+
+	if (supervisor_init(&sv)) {
+		free(slots);
+		cpu_pool_fini(&pool);
+		return 1;
+	}
+
+	while (next < nr || running) {
+		for (i = 0; i < jobs && next < nr; i++) {
+			if (slots[i].pid)
+				continue;
+			slots[i].function = tests[next].function;
+			slots[i].name = tests[next].name;
+			slots[i].capture = true;
+			if (start_job(&sv, &slots[i], &pool, policy)) {
+				report_job(&slots[i], 1, false);
+				failed++;
+			} else
+				running++;
+			next++;
+		}
+
+		/* Every test left failed to start, nothing to wait for */
+		if (!running)
+			continue;
+
+		job = supervise_wait(&sv, slots, jobs);
+		if (!job) {
+			printf("unknown error from waitpid\n");
+			failed++;
+			break;
+		}
+
+		rc = reap_test(job);
+		report_job(job, rc, false);
+		if (rc && rc != MAGIC_SKIP_RETURN_VALUE)
+			failed++;
+
+		cpu_pool_free(&pool, job->cpu);
+		job->pid = 0;
+		running--;
+	}
+
+	supervisor_fini(&sv);
+	cpu_pool_fini(&pool);
+	free(slots);
+	return failed ? 1 : 0;
+}
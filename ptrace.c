@@ -0,0 +1,872 @@
+/*
+ * Ptrace interface test helper functions
+ *
+ * Copyright (C) 2015 Anshuman Khandual, IBM Corporation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+#include "ptrace.h"
+
+static const struct ptrace_backend *backends[BACKEND_MAX];
+
+int ptrace_backend_register(const struct ptrace_backend *b)
+{
+	int i;
+
+	for (i = 0; i < BACKEND_MAX; i++) {
+		if (backends[i] == b)
+			return TEST_PASS;
+		if (!backends[i]) {
+			backends[i] = b;
+			return TEST_PASS;
+		}
+	}
+	printf("Too many ptrace backends\n");
+	return TEST_FAIL;
+}
+
+static struct trace_session sessions[SESSION_MAX];
+
+struct trace_session *trace_session(pid_t child)
+{
+	int i;
+
+	for (i = 0; i < SESSION_MAX; i++)
+		if (sessions[i].pid == child)
+			return &sessions[i];
+	return NULL;
+}
+
+/* A slot for child, reusing one whose tracee has exited */
+static struct trace_session *session_new(pid_t child)
+{
+	struct trace_session *s;
+	int i;
+
+	s = trace_session(child);
+	for (i = 0; !s && i < SESSION_MAX; i++)
+		if (!sessions[i].pid || sessions[i].state == TRACEE_EXITED)
+			s = &sessions[i];
+	if (!s) {
+		printf("Too many tracer sessions\n");
+		return NULL;
+	}
+
+	memset(s, 0, sizeof(*s));
+	s->pid = child;
+	s->state = TRACEE_RUNNING;
+	return s;
+}
+
+/* Record what a waitpid() status says about the tracee */
+static void session_stopped(struct trace_session *s, int status)
+{
+	s->status = status;
+	s->event = 0;
+	s->group_stop = false;
+
+	if (WIFEXITED(status) || WIFSIGNALED(status)) {
+		s->state = TRACEE_EXITED;
+		return;
+	}
+	s->state = TRACEE_STOPPED;
+	s->event = status >> 16;
+
+	switch (s->event) {
+	case 0:
+		/* Signal delivery stop: pass the signal on */
+		s->sig = WSTOPSIG(status);
+		break;
+	case PTRACE_EVENT_STOP:
+		switch (WSTOPSIG(status)) {
+		case SIGSTOP:
+		case SIGTSTP:
+		case SIGTTIN:
+		case SIGTTOU:
+			s->group_stop = true;
+		}
+		break;
+	default:
+		s->events |= 1UL << s->event;
+		if (ptrace(PTRACE_GETEVENTMSG, s->pid, NULL, &s->event_msg))
+			perror("ptrace(PTRACE_GETEVENTMSG) failed");
+		/* New threads start out seized and running to their first stop */
+		if (s->event == PTRACE_EVENT_CLONE)
+			session_new(s->event_msg);
+	}
+}
+
+static int session_wait(struct trace_session *s)
+{
+	int status;
+
+	if (waitpid(s->pid, &status, __WALL) != s->pid) {
+		perror("waitpid() failed");
+		return TEST_FAIL;
+	}
+	session_stopped(s, status);
+	return s->state == TRACEE_EXITED ? TEST_FAIL : TEST_PASS;
+}
+
+/* request is PTRACE_CONT or PTRACE_SINGLESTEP */
+static int session_resume(struct trace_session *s, long request)
+{
+	if (s->state != TRACEE_STOPPED) {
+		printf("Tracee %d is not stopped\n", s->pid);
+		return TEST_FAIL;
+	}
+
+	if (s->group_stop && request == PTRACE_CONT) {
+		if (ptrace(PTRACE_LISTEN, s->pid, NULL, NULL)) {
+			perror("ptrace(PTRACE_LISTEN) failed");
+			return TEST_FAIL;
+		}
+		s->state = TRACEE_LISTENING;
+		return TEST_PASS;
+	}
+
+	if (ptrace(request, s->pid, NULL, s->sig)) {
+		perror(request == PTRACE_CONT ? "ptrace(PTRACE_CONT) failed" :
+						"ptrace(PTRACE_SINGLESTEP) failed");
+		return TEST_FAIL;
+	}
+	s->sig = 0;
+	s->state = TRACEE_RUNNING;
+	return TEST_PASS;
+}
+
+/* Bring a running or listening tracee to a PTRACE_EVENT_STOP */
+static int session_interrupt(struct trace_session *s)
+{
+	if (ptrace(PTRACE_INTERRUPT, s->pid, NULL, NULL)) {
+		perror("ptrace(PTRACE_INTERRUPT) failed");
+		return TEST_FAIL;
+	}
+
+	for (;;) {
+		if (session_wait(s)) {
+			if (s->state == TRACEE_EXITED)
+				printf("Tracee %d exited\n", s->pid);
+			return TEST_FAIL;
+		}
+		if (s->event == PTRACE_EVENT_STOP)
+			return TEST_PASS;
+		/* A signal or an event got there first, let it through */
+		if (session_resume(s, PTRACE_CONT))
+			return TEST_FAIL;
+	}
+}
+
+static int hw_attach(pid_t child)
+{
+	struct trace_session *s = trace_session(child);
+
+	if (s && s->state == TRACEE_STOPPED)
+		return TEST_PASS;
+	if (s && s->state != TRACEE_EXITED)
+		return session_interrupt(s);
+
+	s = session_new(child);
+	if (!s)
+		return TEST_FAIL;
+	if (ptrace(PTRACE_SEIZE, child, NULL, SESSION_OPTIONS)) {
+		perror("ptrace(PTRACE_SEIZE) failed");
+		s->pid = 0;
+		return TEST_FAIL;
+	}
+	return session_interrupt(s);
+}
+
+static int hw_detach(pid_t child)
+{
+	struct trace_session *s = trace_session(child);
+	int sig = 0;
+
+	if (s) {
+		if (s->state != TRACEE_STOPPED && session_interrupt(s))
+			return TEST_FAIL;
+		sig = s->sig;
+		s->pid = 0;
+	}
+
+	if (ptrace(PTRACE_DETACH, child, NULL, sig)) {
+		perror("ptrace(PTRACE_DETACH) failed");
+		return TEST_FAIL;
+	}
+	return TEST_PASS;
+}
+
+static int hw_cont(pid_t child)
+{
+	struct trace_session *s = trace_session(child);
+
+	if (!s) {
+		printf("Tracee %d is not seized\n", child);
+		return TEST_FAIL;
+	}
+	return session_resume(s, PTRACE_CONT);
+}
+
+static long hw_xfer(pid_t child, const struct snapshot_regset *r,
+		    void *buf, bool set)
+{
+	struct iovec iov;
+
+	if (r->request != PTRACE_GETREGSET)
+		return ptrace(set ? r->set_request : r->request, child, NULL, buf);
+
+	iov.iov_base = buf;
+	iov.iov_len = r->size;
+	if (ptrace(set ? r->set_request : r->request, child, r->note, &iov))
+		return -1;
+
+	/* A shorter regset than our layout would leave the rest stale */
+	if (iov.iov_len != r->size) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+	return 0;
+}
+
+static const struct ptrace_backend hw_backend = {
+	.name	= "ptrace",
+	.attach	= hw_attach,
+	.detach	= hw_detach,
+	.cont	= hw_cont,
+	.xfer	= hw_xfer,
+};
+
+static const struct ptrace_backend *backend_of(pid_t child)
+{
+	int i;
+
+	for (i = 0; i < BACKEND_MAX && backends[i]; i++)
+		if (backends[i]->owns(child))
+			return backends[i];
+	return &hw_backend;
+}
+
+long regset_xfer(pid_t child, const struct snapshot_regset *r, void *buf, bool set)
+{
+	return backend_of(child)->xfer(child, r, buf, set);
+}
+
+void regset_perror(pid_t child, const struct snapshot_regset *r, bool set)
+{
+	char what[64];
+
+	snprintf(what, sizeof(what), "%s: %s %s regset failed",
+		 backend_of(child)->name, set ? "set" : "get", r->name);
+	perror(what);
+}
+
+static struct regset_cache *regcaches[REGCACHE_MAX];
+
+int regcache_attach(struct regset_cache *cache, pid_t child)
+{
+	int i;
+
+	for (i = 0; i < REGCACHE_MAX; i++) {
+		if (!regcaches[i]) {
+			cache->pid = child;
+			cache->valid = 0;
+			cache->dirty = 0;
+			regcaches[i] = cache;
+			return TEST_PASS;
+		}
+	}
+	printf("Too many regset caches\n");
+	return TEST_FAIL;
+}
+
+void regcache_detach(struct regset_cache *cache)
+{
+	int i;
+
+	for (i = 0; i < REGCACHE_MAX; i++)
+		if (regcaches[i] == cache)
+			regcaches[i] = NULL;
+}
+
+static struct regset_cache *regcache_lookup(pid_t child)
+{
+	int i;
+
+	for (i = 0; i < REGCACHE_MAX; i++)
+		if (regcaches[i] && regcaches[i]->pid == child)
+			return regcaches[i];
+	return NULL;
+}
+
+/* Cached copy of one regset, fetched from the tracee on first use */
+void *regcache_get(struct regset_cache *cache, unsigned long flag)
+{
+	const struct snapshot_regset *r = regset_lookup(flag);
+	void *buf = (char *)&cache->regs + r->offset;
+
+	if (!(cache->valid & flag)) {
+		if (regset_xfer(cache->pid, r, buf, false)) {
+			regset_perror(cache->pid, r, false);
+			return NULL;
+		}
+		cache->valid |= flag;
+	}
+	return buf;
+}
+
+static inline void regcache_dirty(struct regset_cache *cache, unsigned long flag)
+{
+	cache->dirty |= flag;
+}
+
+/* Write back every dirty regset and forget the stop */
+int regcache_flush(struct regset_cache *cache)
+{
+	const struct snapshot_regset *r;
+	unsigned long dirty = cache->dirty;
+	int ret = TEST_PASS;
+
+	while (dirty) {
+		r = regset_lookup(dirty & -dirty);
+		dirty &= dirty - 1;
+
+		if (regset_xfer(cache->pid, r, (char *)&cache->regs + r->offset, true)) {
+			regset_perror(cache->pid, r, true);
+			ret = TEST_FAIL;
+		}
+	}
+	cache->valid = 0;
+	cache->dirty = 0;
+	return ret;
+}
+
+/*
+ * Read one regset, from the cache when the tracee has one, otherwise
+ * into the caller supplied buffer. Returns the buffer holding the data.
+ */
+static void *regset_read(pid_t child, unsigned long flag, void *buf)
+{
+	struct regset_cache *cache = regcache_lookup(child);
+
+	if (cache)
+		return regcache_get(cache, flag);
+
+	if (regset_xfer(child, regset_lookup(flag), buf, false)) {
+		regset_perror(child, regset_lookup(flag), false);
+		return NULL;
+	}
+	return buf;
+}
+
+/* Counterpart of regset_read(): defers the write when cached */
+static int regset_write(pid_t child, unsigned long flag, void *buf)
+{
+	struct regset_cache *cache = regcache_lookup(child);
+	const struct snapshot_regset *r = regset_lookup(flag);
+	void *cached;
+
+	if (cache) {
+		cached = (char *)&cache->regs + r->offset;
+		if (buf != cached)
+			memcpy(cached, buf, r->size);
+		cache->valid |= flag;
+		regcache_dirty(cache, flag);
+		return TEST_PASS;
+	}
+
+	if (regset_xfer(child, r, buf, true)) {
+		regset_perror(child, r, true);
+		return TEST_FAIL;
+	}
+	return TEST_PASS;
+}
+
+int start_trace(pid_t child)
+{
+	if (backend_of(child)->attach(child))
+		return TEST_FAIL;
+
+	test_mark_stop();
+	return TEST_PASS;
+}
+
+int stop_trace(pid_t child)
+{
+	struct regset_cache *cache = regcache_lookup(child);
+
+	if (cache && regcache_flush(cache))
+		return TEST_FAIL;
+
+	return backend_of(child)->detach(child);
+}
+
+int cont_trace(pid_t child)
+{
+	struct regset_cache *cache = regcache_lookup(child);
+
+	if (cache && regcache_flush(cache))
+		return TEST_FAIL;
+
+	return backend_of(child)->cont(child);
+}
+
+int wait_trace(pid_t child)
+{
+	struct trace_session *s = trace_session(child);
+
+	if (!s || s->state == TRACEE_EXITED) {
+		printf("Tracee %d is not seized\n", child);
+		return TEST_FAIL;
+	}
+	return session_wait(s);
+}
+
+int kill_trace(pid_t child)
+{
+	struct trace_session *s = trace_session(child);
+
+	kill(child, SIGKILL);
+	if (!s)
+		return waitpid(child, NULL, 0) == child ? TEST_PASS : TEST_FAIL;
+
+	/* Older kernels still stop it at PTRACE_EVENT_EXIT */
+	while (session_wait(s) == TEST_PASS)
+		session_resume(s, PTRACE_CONT);
+	return s->state == TRACEE_EXITED ? TEST_PASS : TEST_FAIL;
+}
+
+int step_trace(pid_t child)
+{
+	struct regset_cache *cache = regcache_lookup(child);
+	struct trace_session *s = trace_session(child);
+
+	if (cache && regcache_flush(cache))
+		return TEST_FAIL;
+	if (!s) {
+		printf("Tracee %d is not seized\n", child);
+		return TEST_FAIL;
+	}
+	return session_resume(s, PTRACE_SINGLESTEP);
+}
+
+/* EBB */
+int show_ebb_registers(pid_t child, struct ebb_regs *regs)
+{
+	struct ebb_regs buf, *ebb;
+
+	ebb = regset_read(child, SNAP_EBB, &buf);
+	if (!ebb)
+		return TEST_FAIL;
+
+	if (regs)
+		*regs = *ebb;
+	return TEST_PASS;
+}
+
+/* TAR, PPR, DSCR */
+static int show_spr_triplet(pid_t child, unsigned long first, unsigned long *out)
+{
+	unsigned long buf, *reg;
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		reg = regset_read(child, first << i, &buf);
+		if (!reg)
+			return TEST_FAIL;
+		if (out)
+			out[i] = *reg;
+	}
+	return TEST_PASS;
+}
+
+static int write_spr_triplet(pid_t child, unsigned long first, unsigned long *val)
+{
+	int i;
+
+	for (i = 0; i < 3; i++)
+		if (regset_write(child, first << i, &val[i]))
+			return TEST_FAIL;
+	return TEST_PASS;
+}
+
+int show_tar_registers(pid_t child, unsigned long *out)
+{
+	return show_spr_triplet(child, SNAP_TAR, out);
+}
+
+int write_tar_registers(pid_t child, unsigned long tar, unsigned long ppr, unsigned long dscr)
+{
+	unsigned long val[3] = { tar, ppr, dscr };
+
+	return write_spr_triplet(child, SNAP_TAR, val);
+}
+
+int show_tm_checkpointed_state(pid_t child, unsigned long *out)
+{
+	return show_spr_triplet(child, SNAP_CTAR, out);
+}
+
+int write_ckpt_tar_registers(pid_t child, unsigned long tar, unsigned long ppr, unsigned long dscr)
+{
+	unsigned long val[3] = { tar, ppr, dscr };
+
+	return write_spr_triplet(child, SNAP_CTAR, val);
+}
+
+/* FPR */
+static int show_fpr_common(pid_t child, unsigned long flag, unsigned long *fpr)
+{
+	struct fpr_regs buf, *regs;
+
+	regs = regset_read(child, flag, &buf);
+	if (!regs)
+		return TEST_FAIL;
+
+	if (fpr)
+		memcpy(fpr, regs->fpr, sizeof(regs->fpr));
+	return TEST_PASS;
+}
+
+static int write_fpr_common(pid_t child, unsigned long flag, unsigned long val)
+{
+	struct fpr_regs buf, *regs;
+	int i;
+
+	regs = regset_read(child, flag, &buf);
+	if (!regs)
+		return TEST_FAIL;
+
+	for (i = 0; i < 32; i++)
+		regs->fpr[i] = val;
+
+	return regset_write(child, flag, regs);
+}
+
+int show_fpr(pid_t child, unsigned long *fpr)
+{
+	return show_fpr_common(child, SNAP_FPR, fpr);
+}
+
+int write_fpr(pid_t child, unsigned long val)
+{
+	return write_fpr_common(child, SNAP_FPR, val);
+}
+
+int show_ckpt_fpr(pid_t child, unsigned long *fpr)
+{
+	return show_fpr_common(child, SNAP_CFPR, fpr);
+}
+
+int write_ckpt_fpr(pid_t child, unsigned long val)
+{
+	return write_fpr_common(child, SNAP_CFPR, val);
+}
+
+/* GPR - only the non volatile r14-r31 are shown and written */
+static int show_gpr_common(pid_t child, unsigned long flag, unsigned long *gpr)
+{
+	struct pt_regs buf, *regs;
+
+	regs = regset_read(child, flag, &buf);
+	if (!regs)
+		return TEST_FAIL;
+
+	if (gpr)
+		memcpy(gpr, &regs->gpr[14], 18 * sizeof(unsigned long));
+	return TEST_PASS;
+}
+
+static int write_gpr_common(pid_t child, unsigned long flag, unsigned long val)
+{
+	struct pt_regs buf, *regs;
+	int i;
+
+	regs = regset_read(child, flag, &buf);
+	if (!regs)
+		return TEST_FAIL;
+
+	for (i = 14; i < 32; i++)
+		regs->gpr[i] = val;
+
+	return regset_write(child, flag, regs);
+}
+
+int show_gpr(pid_t child, unsigned long *gpr)
+{
+	return show_gpr_common(child, SNAP_GPR, gpr);
+}
+
+int write_gpr(pid_t child, unsigned long val)
+{
+	return write_gpr_common(child, SNAP_GPR, val);
+}
+
+int show_ckpt_gpr(pid_t child, unsigned long *gpr)
+{
+	return show_gpr_common(child, SNAP_CGPR, gpr);
+}
+
+int write_ckpt_gpr(pid_t child, unsigned long val)
+{
+	return write_gpr_common(child, SNAP_CGPR, val);
+}
+
+/* Whole regset copied to or from the caller's buffer */
+static int show_regset(pid_t child, unsigned long flag, void *out)
+{
+	void *regs;
+
+	regs = regset_read(child, flag, out);
+	if (!regs)
+		return TEST_FAIL;
+
+	if (regs != out)
+		memcpy(out, regs, regset_lookup(flag)->size);
+	return TEST_PASS;
+}
+
+/* VMX - vmx[] must hold 34 entries (VR0-31, VSCR, VRSAVE) */
+int show_vmx(pid_t child, unsigned long vmx[][2])
+{
+	return show_regset(child, SNAP_VMX, vmx);
+}
+
+int show_vmx_ckpt(pid_t child, unsigned long vmx[][2])
+{
+	return show_regset(child, SNAP_CVMX, vmx);
+}
+
+int write_vmx(pid_t child, unsigned long vmx[][2])
+{
+	return regset_write(child, SNAP_VMX, vmx);
+}
+
+int write_vmx_ckpt(pid_t child, unsigned long vmx[][2])
+{
+	return regset_write(child, SNAP_CVMX, vmx);
+}
+
+/* VSX - vsx[] must hold 32 entries (low doublewords of VSR0-31) */
+int show_vsx(pid_t child, unsigned long *vsx)
+{
+	return show_regset(child, SNAP_VSX, vsx);
+}
+
+int show_vsx_ckpt(pid_t child, unsigned long *vsx)
+{
+	return show_regset(child, SNAP_CVSX, vsx);
+}
+
+int write_vsx(pid_t child, unsigned long *vsx)
+{
+	return regset_write(child, SNAP_VSX, vsx);
+}
+
+int write_vsx_ckpt(pid_t child, unsigned long *vsx)
+{
+	return regset_write(child, SNAP_CVSX, vsx);
+}
+
+/* TM SPR */
+int show_tm_spr(pid_t child, struct tm_spr_regs *out)
+{
+	struct tm_spr_regs buf, *regs;
+
+	regs = regset_read(child, SNAP_TM_SPR, &buf);
+	if (!regs)
+		return TEST_FAIL;
+
+	if (out)
+		*out = *regs;
+	return TEST_PASS;
+}
+
+/* Full snapshot */
+int snapshot_all(pid_t child, struct reg_snapshot *snap)
+{
+	const struct snapshot_regset *r;
+	unsigned long skip = 0;
+	unsigned int i;
+	void *buf;
+	long ret;
+
+	snap->valid = 0;
+	for (i = 0; i < ARRAY_SIZE(snapshot_regsets); i++) {
+		r = &snapshot_regsets[i];
+
+		if (r->flag & skip)
+			continue;
+		if (!have_hwcap(r->hwcap) || !have_hwcap2(r->hwcap2))
+			continue;
+
+		buf = (char *)snap + r->offset;
+		ret = regset_xfer(child, r, buf, false);
+		if (ret) {
+			if (errno != ENODATA) {
+				regset_perror(child, r, false);
+				return TEST_FAIL;
+			}
+			if (r->flag == SNAP_CGPR)
+				skip = SNAP_CKPT;
+			continue;
+		}
+		snap->valid |= r->flag;
+	}
+	return TEST_PASS;
+}
+
+#if defined(__VSX__) || defined(__SSE2__)
+#define DIFF_SIMD
+typedef unsigned long diff_vec_t __attribute__((vector_size(16)));
+#endif
+
+/*
+ * Diff nr (<= 64) doublewords, returning a mask of the ones that differ.
+ * Works two vectors (four doublewords) per step and only falls back to
+ * per word tests when the step contains a difference.
+ */
+static unsigned long diff_words(const unsigned long *a, const unsigned long *b,
+				unsigned long *bits, int nr)
+{
+	unsigned long mask = 0;
+	int i = 0, j;
+
+#ifdef DIFF_SIMD
+	diff_vec_t va0, vb0, va1, vb1, x0, x1, any;
+
+	for (; i + 4 <= nr; i += 4) {
+		__builtin_memcpy(&va0, &a[i], sizeof(va0));
+		__builtin_memcpy(&vb0, &b[i], sizeof(vb0));
+		__builtin_memcpy(&va1, &a[i + 2], sizeof(va1));
+		__builtin_memcpy(&vb1, &b[i + 2], sizeof(vb1));
+		x0 = va0 ^ vb0;
+		x1 = va1 ^ vb1;
+		__builtin_memcpy(&bits[i], &x0, sizeof(x0));
+		__builtin_memcpy(&bits[i + 2], &x1, sizeof(x1));
+
+		any = x0 | x1;
+		if (!(any[0] | any[1]))
+			continue;
+
+		for (j = i; j < i + 4; j++)
+			if (bits[j])
+				mask |= 1UL << j;
+	}
+#endif
+	for (; i < nr; i++) {
+		bits[i] = a[i] ^ b[i];
+		if (bits[i])
+			mask |= 1UL << i;
+	}
+	return mask;
+}
+
+static unsigned long diff_spr(unsigned long a, unsigned long b,
+			      unsigned long *bits, unsigned long flag)
+{
+	*bits = a ^ b;
+	return *bits ? flag : 0;
+}
+
+/*
+ * Diff the register classes selected by which (running SNAP_* flags).
+ * Returns the number of differing slots.
+ */
+int reg_set_diff(const struct reg_set *a, const struct reg_set *b,
+		 unsigned long which, struct reg_diff *d)
+{
+	memset(d, 0, sizeof(*d));
+
+	if (which & SNAP_GPR) {
+		d->gpr = diff_words(a->gpr.gpr, b->gpr.gpr, d->gpr_bits, 32);
+		d->spr |= diff_spr(a->gpr.ctr, b->gpr.ctr, &d->spr_bits[0], DIFF_SPR_CTR);
+		d->spr |= diff_spr(a->gpr.link, b->gpr.link, &d->spr_bits[1], DIFF_SPR_LR);
+		d->spr |= diff_spr(a->gpr.xer, b->gpr.xer, &d->spr_bits[2], DIFF_SPR_XER);
+		d->spr |= diff_spr(a->gpr.ccr, b->gpr.ccr, &d->spr_bits[3], DIFF_SPR_CR);
+	}
+	if (which & SNAP_FPR)
+		d->fpr = diff_words(a->fpr.fpr, b->fpr.fpr, d->fpr_bits, 33);
+	if (which & SNAP_VMX) {
+		unsigned long lo, hi;
+		int i;
+
+		/* Quadword slots: diff as 68 doublewords, then fold pairs */
+		lo = diff_words(a->vmx.vr[0], b->vmx.vr[0], d->vmx_bits[0], 64);
+		hi = diff_words(a->vmx.vr[32], b->vmx.vr[32], d->vmx_bits[32], 4);
+		for (i = 0; i < 32; i++)
+			if (lo & (3UL << (2 * i)))
+				d->vmx |= 1UL << i;
+		if (hi & 3)
+			d->vmx |= 1UL << 32;
+		if (hi & 12)
+			d->vmx |= 1UL << 33;
+	}
+	if (which & SNAP_VSX)
+		d->vsx = diff_words(a->vsx.vsr, b->vsx.vsr, d->vsx_bits, 32);
+	if (which & SNAP_TAR)
+		d->spr |= diff_spr(a->tar, b->tar, &d->spr_bits[4], DIFF_SPR_TAR);
+	if (which & SNAP_PPR)
+		d->spr |= diff_spr(a->ppr, b->ppr, &d->spr_bits[5], DIFF_SPR_PPR);
+	if (which & SNAP_DSCR)
+		d->spr |= diff_spr(a->dscr, b->dscr, &d->spr_bits[6], DIFF_SPR_DSCR);
+
+	return __builtin_popcountl(d->gpr) + __builtin_popcountl(d->fpr) +
+	       __builtin_popcountl(d->vmx) + __builtin_popcountl(d->vsx) +
+	       __builtin_popcountl(d->spr);
+}
+
+int snapshot_diff(const struct reg_snapshot *a, const struct reg_snapshot *b,
+		  struct reg_diff *live, struct reg_diff *ckpt)
+{
+	unsigned long valid = a->valid & b->valid;
+	int nr;
+
+	nr = reg_set_diff(&a->live, &b->live, valid & SNAP_REG_SET, live);
+	if (ckpt)
+		nr += reg_set_diff(&a->ckpt, &b->ckpt,
+				   (valid & SNAP_CKPT) >> SNAP_CKPT_SHIFT, ckpt);
+	return nr;
+}
+
+int snapshot_diff_ckpt(const struct reg_snapshot *snap, struct reg_diff *d)
+{
+	unsigned long which;
+
+	which = snap->valid & SNAP_REG_SET &
+		((snap->valid & SNAP_CKPT) >> SNAP_CKPT_SHIFT);
+	return reg_set_diff(&snap->live, &snap->ckpt, which, d);
+}
+
+void reg_diff_print(const char *prefix, const struct reg_diff *d)
+{
+	static const char * const spr_names[DIFF_NR_SPRS] = {
+		"ctr", "lr", "xer", "cr", "tar", "ppr", "dscr"
+	};
+	int i;
+
+	for (i = 0; i < 32; i++)
+		if (d->gpr & (1UL << i))
+			printf("%s r%d ^%lx\n", prefix, i, d->gpr_bits[i]);
+	for (i = 0; i < 32; i++)
+		if (d->fpr & (1UL << i))
+			printf("%s f%d ^%lx\n", prefix, i, d->fpr_bits[i]);
+	if (d->fpr & (1UL << 32))
+		printf("%s fpscr ^%lx\n", prefix, d->fpr_bits[32]);
+	for (i = 0; i < 32; i++)
+		if (d->vmx & (1UL << i))
+			printf("%s vr%d ^%lx:%lx\n", prefix, i,
+			       d->vmx_bits[i][0], d->vmx_bits[i][1]);
+	if (d->vmx & (1UL << 32))
+		printf("%s vscr ^%lx:%lx\n", prefix, d->vmx_bits[32][0], d->vmx_bits[32][1]);
+	if (d->vmx & (1UL << 33))
+		printf("%s vrsave ^%lx:%lx\n", prefix, d->vmx_bits[33][0], d->vmx_bits[33][1]);
+	for (i = 0; i < 32; i++)
+		if (d->vsx & (1UL << i))
+			printf("%s vs%d ^%lx\n", prefix, i, d->vsx_bits[i]);
+	for (i = 0; i < DIFF_NR_SPRS; i++)
+		if (d->spr & (1UL << i))
+			printf("%s %s ^%lx\n", prefix, spr_names[i], d->spr_bits[i]);
+}
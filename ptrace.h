@@ -8,11 +8,15 @@
  * as published by the Free Software Foundation; either version
  * 2 of the License, or (at your option) any later version.
  */
+#ifndef _PTRACE_H
+#define _PTRACE_H
+
 #include <inttypes.h>
+#include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
-#include <malloc.h>
+#include <stddef.h>
 #include <errno.h>
 #include <time.h>
 #include <sys/ptrace.h>
@@ -29,40 +33,64 @@
 #include <linux/auxvec.h>
 #include "../reg.h"
 #include "utils.h"
+#include "texasr.h"
 
-/* ELF core note sections */
+/*
+ * The register layouts and requests are the ppc64 ones everywhere, so
+ * the software backend (sim.h) also builds on other architectures.
+ */
+#ifndef __powerpc__
+struct ppc_pt_regs {
+	unsigned long gpr[32];
+	unsigned long nip;
+	unsigned long msr;
+	unsigned long orig_gpr3;
+	unsigned long ctr;
+	unsigned long link;
+	unsigned long xer;
+	unsigned long ccr;
+	unsigned long softe;
+	unsigned long trap;
+	unsigned long dar;
+	unsigned long dsisr;
+	unsigned long result;
+};
+#define pt_regs		ppc_pt_regs
+#endif
+
+#ifndef PTRACE_GETREGS
+#define PTRACE_GETREGS		12
+#define PTRACE_SETREGS		13
+#endif
+#ifndef PTRACE_GETFPREGS
+#define PTRACE_GETFPREGS	14
+#define PTRACE_SETFPREGS	15
+#endif
+#ifndef PTRACE_GETVRREGS
+#define PTRACE_GETVRREGS	18
+#define PTRACE_SETVRREGS	19
+#endif
+#ifndef PTRACE_GETVSRREGS
+#define PTRACE_GETVSRREGS	27
+#define PTRACE_SETVSRREGS	28
+#endif
+
+/* ELF core note sections, for <linux/elf.h> older than the TM regsets */
+#ifndef NT_PPC_TM_CDSCR
 #define NT_PPC_TAR	0x103		/* Target Address Register */
 #define NT_PPC_PPR	0x104		/* Program Priority Register */
 #define NT_PPC_DSCR	0x105		/* Data Stream Control Register */
 #define NT_PPC_EBB	0x106		/* Event Based Branch Registers */
-#define NT_PPC_TM_CGPR	0x107		/* TM checkpointed GPR Registers */
-#define NT_PPC_TM_CFPR	0x108		/* TM checkpointed FPR Registers */
-#define NT_PPC_TM_CVMX	0x109		/* TM checkpointed VMX Registers */
-#define NT_PPC_TM_CVSX	0x10a		/* TM checkpointed VSX Registers */
-#define NT_PPC_TM_SPR	0x10b		/* TM Special Purpose Registers */
-#define NT_PPC_TM_CTAR	0x10c		/* TM checkpointed Target Address Register */
-#define NT_PPC_TM_CPPR	0x10d		/* TM checkpointed Program Priority Register */
-#define NT_PPC_TM_CDSCR	0x10e		/* TM checkpointed Data Stream Control Register */
-
-/* TEXASR register bits */
-#define TEXASR_FC	0xFE00000000000000
-#define TEXASR_FP	0x0100000000000000
-#define TEXASR_DA	0x0080000000000000
-#define TEXASR_NO	0x0040000000000000
-#define TEXASR_FO	0x0020000000000000
-#define TEXASR_SIC	0x0010000000000000
-#define TEXASR_NTC	0x0008000000000000
-#define TEXASR_TC	0x0004000000000000
-#define TEXASR_TIC	0x0002000000000000
-#define TEXASR_IC	0x0001000000000000
-#define TEXASR_IFC	0x0000800000000000
-#define TEXASR_ABT	0x0000000100000000
-#define TEXASR_SPD	0x0000000080000000
-#define TEXASR_HV	0x0000000020000000
-#define TEXASR_PR	0x0000000010000000
-#define TEXASR_FS	0x0000000008000000
-#define TEXASR_TE	0x0000000004000000
-#define TEXASR_ROT	0x0000000002000000
+#define NT_PPC_PMU	0x107		/* Performance Monitor Registers */
+#define NT_PPC_TM_CGPR	0x108		/* TM checkpointed GPR Registers */
+#define NT_PPC_TM_CFPR	0x109		/* TM checkpointed FPR Registers */
+#define NT_PPC_TM_CVMX	0x10a		/* TM checkpointed VMX Registers */
+#define NT_PPC_TM_CVSX	0x10b		/* TM checkpointed VSX Registers */
+#define NT_PPC_TM_SPR	0x10c		/* TM Special Purpose Registers */
+#define NT_PPC_TM_CTAR	0x10d		/* TM checkpointed Target Address Register */
+#define NT_PPC_TM_CPPR	0x10e		/* TM checkpointed Program Priority Register */
+#define NT_PPC_TM_CDSCR	0x10f		/* TM checkpointed Data Stream Control Register */
+#endif
 
 #define TEST_PASS 0
 #define TEST_FAIL 1
@@ -71,6 +99,9 @@ struct ebb_regs {
 	unsigned long	ebbrr;
 	unsigned long	ebbhr;
 	unsigned long	bescr;
+};
+
+struct pmu_regs {
 	unsigned long	siar;
 	unsigned long	sdar;
 	unsigned long	sier;
@@ -89,678 +120,317 @@ struct tm_spr_regs {
 	unsigned long tm_tfiar;
 };
 
-/* Basic ptrace operations */
-int start_trace(pid_t child)
-{
-	int ret;
-
-	ret = ptrace(PTRACE_ATTACH, child, NULL, NULL);
-	if (ret) {
-		perror("ptrace(PTRACE_ATTACH) failed");
-		return TEST_FAIL;
-	}
-	ret = waitpid(child, NULL, 0);
-	if (ret != child) {
-		perror("waitpid() failed");
-		return TEST_FAIL;
-	}
-	return TEST_PASS;
-}
+/* VR0-31, VSCR and VRSAVE, each in a quadword */
+struct vmx_regs {
+	unsigned long vr[34][2];
+} __attribute__((aligned(16)));
 
-int stop_trace(pid_t child)
-{
-	int ret;
-
-	ret = ptrace(PTRACE_DETACH, child, NULL, NULL);
-	if (ret) {
-		perror("ptrace(PTRACE_DETACH) failed");
-		return TEST_FAIL;
-	}
-	return TEST_PASS;
-}
+/* Low doublewords of VSR0-31, the rest aliases the FPRs */
+struct vsx_regs {
+	unsigned long vsr[32];
+};
 
-int cont_trace(pid_t child)
-{
-	int ret;
-
-	ret = ptrace(PTRACE_CONT, child, NULL, NULL);
-	if (ret) {
-		perror("ptrace(PTRACE_CONT) failed");
-		return TEST_FAIL;
-	}
-	return TEST_PASS;
-}
+/* One copy, either running or checkpointed, of the register file */
+struct reg_set {
+	struct pt_regs gpr;
+	struct fpr_regs fpr;
+	struct vmx_regs vmx;
+	struct vsx_regs vsx;
+	unsigned long tar;
+	unsigned long ppr;
+	unsigned long dscr;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+/* Regsets present in struct reg_snapshot (valid mask) */
+#define SNAP_GPR	0x00001
+#define SNAP_FPR	0x00002
+#define SNAP_VMX	0x00004
+#define SNAP_VSX	0x00008
+#define SNAP_TAR	0x00010
+#define SNAP_PPR	0x00020
+#define SNAP_DSCR	0x00040
+#define SNAP_EBB	0x00080
+#define SNAP_TM_SPR	0x00100
+#define SNAP_CGPR	0x00200
+#define SNAP_CFPR	0x00400
+#define SNAP_CVMX	0x00800
+#define SNAP_CVSX	0x01000
+#define SNAP_CTAR	0x02000
+#define SNAP_CPPR	0x04000
+#define SNAP_CDSCR	0x08000
+#define SNAP_PMU	0x10000
+
+#define SNAP_CKPT	(SNAP_CGPR | SNAP_CFPR | SNAP_CVMX | SNAP_CVSX | \
+			 SNAP_CTAR | SNAP_CPPR | SNAP_CDSCR)
+#define SNAP_REG_SET	(SNAP_GPR | SNAP_FPR | SNAP_VMX | SNAP_VSX | \
+			 SNAP_TAR | SNAP_PPR | SNAP_DSCR)
+
+/* SNAP_C* flag >> SNAP_CKPT_SHIFT gives the matching running flag */
+#define SNAP_CKPT_SHIFT	9
+
+/* Complete tracee state at one stop, filled by snapshot_all() */
+struct reg_snapshot {
+	struct reg_set live;
+	struct reg_set ckpt;
+	struct tm_spr_regs tm_spr;
+	struct ebb_regs ebb;
+	struct pmu_regs pmu;
+	unsigned long valid;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+/* Regset table, indexed by the bit number of the SNAP_* flag */
+struct snapshot_regset {
+	unsigned long	flag;
+	const char	*name;
+	long		request;	/* PTRACE_GETREGSET or a legacy request */
+	long		set_request;
+	long		note;
+	size_t		offset;
+	size_t		size;
+	unsigned long	hwcap;
+	unsigned long	hwcap2;
+};
 
-/* EBB */
-int show_ebb_registers(pid_t child, struct ebb_regs *regs)
-{
-	struct ebb_regs *ebb;
-	struct iovec iov;
-	int ret;
-
-	ebb = malloc(sizeof(struct ebb_regs));
-	if (!ebb) {
-		perror("malloc() failed");
-		return TEST_FAIL;
-	}
-
-	iov.iov_base = (struct ebb_regs *) ebb;
-	iov.iov_len = sizeof(struct ebb_regs);
-	ret = ptrace(PTRACE_GETREGSET, child, NT_PPC_EBB, &iov);
-	if (ret) {
-		perror("ptrace(PTRACE_GETREGSET) failed");
-		goto fail;
-	}
-
-	if (regs)
-		memcpy(regs, ebb, sizeof(struct ebb_regs));
-
-	free(ebb);
-	return TEST_PASS;
-fail:
-	free(ebb);
-	return TEST_FAIL;
-}
+#define REGSET_LIVE(f)	offsetof(struct reg_snapshot, live.f), \
+			sizeof(((struct reg_snapshot *)0)->live.f)
+#define REGSET_CKPT(f)	offsetof(struct reg_snapshot, ckpt.f), \
+			sizeof(((struct reg_snapshot *)0)->ckpt.f)
+#define REGSET_FIELD(f)	offsetof(struct reg_snapshot, f), \
+			sizeof(((struct reg_snapshot *)0)->f)
 
-/* TAR, PPR, DSCR */
-int show_tar_registers(pid_t child, unsigned long *out)
-{
-	struct iovec iov;
-	unsigned long *reg;
-	int ret;
-
-	reg = malloc(sizeof(unsigned long));
-	if (!reg) {
-		perror("malloc() failed");
-		return TEST_FAIL;
-	}
-	iov.iov_base = (u64 *) reg;
-	iov.iov_len = sizeof(unsigned long);
-
-	ret = ptrace(PTRACE_GETREGSET, child, NT_PPC_TAR, &iov);
-	if (ret) {
-		perror("ptrace(PTRACE_GETREGSET) failed");
-		goto fail;
-	}
-	if (out)
-		out[0] = *reg;
-
-	ret = ptrace(PTRACE_GETREGSET, child, NT_PPC_PPR, &iov);
-	if (ret) {
-		perror("ptrace(PTRACE_GETREGSET) failed");
-		goto fail;
-	}
-	if (out)
-		out[1] = *reg;
-
-	ret = ptrace(PTRACE_GETREGSET, child, NT_PPC_DSCR, &iov);
-	if (ret) {
-		perror("ptrace(PTRACE_GETREGSET) failed");
-		goto fail;
-	}
-	if (out)
-		out[2] = *reg;
-
-	free(reg);
-	return TEST_PASS;
-fail:
-	free(reg);
-	return TEST_FAIL;
-}
+/*
+ * Checkpointed entries must stay contiguous and start with SNAP_CGPR:
+ * when the tracee is not in a transaction the first one fails with
+ * ENODATA and the rest of them are skipped without further syscalls.
+ */
+static const struct snapshot_regset snapshot_regsets[] = {
+	{ SNAP_GPR, "gpr", PTRACE_GETREGS, PTRACE_SETREGS, 0, REGSET_LIVE(gpr), 0, 0 },
+	{ SNAP_FPR, "fpr", PTRACE_GETFPREGS, PTRACE_SETFPREGS, 0, REGSET_LIVE(fpr), 0, 0 },
+	{ SNAP_VMX, "vmx", PTRACE_GETVRREGS, PTRACE_SETVRREGS, 0, REGSET_LIVE(vmx), PPC_FEATURE_HAS_ALTIVEC, 0 },
+	{ SNAP_VSX, "vsx", PTRACE_GETVSRREGS, PTRACE_SETVSRREGS, 0, REGSET_LIVE(vsx), PPC_FEATURE_HAS_VSX, 0 },
+	{ SNAP_TAR, "tar", PTRACE_GETREGSET, PTRACE_SETREGSET, NT_PPC_TAR, REGSET_LIVE(tar), 0, PPC_FEATURE2_TAR },
+	{ SNAP_PPR, "ppr", PTRACE_GETREGSET, PTRACE_SETREGSET, NT_PPC_PPR, REGSET_LIVE(ppr), 0, PPC_FEATURE2_ARCH_2_07 },
+	{ SNAP_DSCR, "dscr", PTRACE_GETREGSET, PTRACE_SETREGSET, NT_PPC_DSCR, REGSET_LIVE(dscr), 0, PPC_FEATURE2_DSCR },
+	{ SNAP_EBB, "ebb", PTRACE_GETREGSET, PTRACE_SETREGSET, NT_PPC_EBB, REGSET_FIELD(ebb), 0, PPC_FEATURE2_EBB },
+	{ SNAP_TM_SPR, "tm_spr", PTRACE_GETREGSET, PTRACE_SETREGSET, NT_PPC_TM_SPR, REGSET_FIELD(tm_spr), 0, PPC_FEATURE2_HTM },
+	{ SNAP_CGPR, "tm_cgpr", PTRACE_GETREGSET, PTRACE_SETREGSET, NT_PPC_TM_CGPR, REGSET_CKPT(gpr), 0, PPC_FEATURE2_HTM },
+	{ SNAP_CFPR, "tm_cfpr", PTRACE_GETREGSET, PTRACE_SETREGSET, NT_PPC_TM_CFPR, REGSET_CKPT(fpr), 0, PPC_FEATURE2_HTM },
+	{ SNAP_CVMX, "tm_cvmx", PTRACE_GETREGSET, PTRACE_SETREGSET, NT_PPC_TM_CVMX, REGSET_CKPT(vmx), PPC_FEATURE_HAS_ALTIVEC, PPC_FEATURE2_HTM },
+	{ SNAP_CVSX, "tm_cvsx", PTRACE_GETREGSET, PTRACE_SETREGSET, NT_PPC_TM_CVSX, REGSET_CKPT(vsx), PPC_FEATURE_HAS_VSX, PPC_FEATURE2_HTM },
+	{ SNAP_CTAR, "tm_ctar", PTRACE_GETREGSET, PTRACE_SETREGSET, NT_PPC_TM_CTAR, REGSET_CKPT(tar), 0, PPC_FEATURE2_HTM | PPC_FEATURE2_TAR },
+	{ SNAP_CPPR, "tm_cppr", PTRACE_GETREGSET, PTRACE_SETREGSET, NT_PPC_TM_CPPR, REGSET_CKPT(ppr), 0, PPC_FEATURE2_HTM },
+	{ SNAP_CDSCR, "tm_cdscr", PTRACE_GETREGSET, PTRACE_SETREGSET, NT_PPC_TM_CDSCR, REGSET_CKPT(dscr), 0, PPC_FEATURE2_HTM | PPC_FEATURE2_DSCR },
+	{ SNAP_PMU, "pmu", PTRACE_GETREGSET, PTRACE_SETREGSET, NT_PPC_PMU, REGSET_FIELD(pmu), 0, PPC_FEATURE2_ARCH_2_07 },
+};
 
-int write_tar_registers(pid_t child, unsigned long tar, unsigned long ppr, unsigned long dscr)
-{
-	struct iovec iov;
-	unsigned long *reg;
-	int ret;
-
-	reg = malloc(sizeof(unsigned long));
-	if (!reg) {
-		perror("malloc() failed");
-		return TEST_FAIL;
-	}
-
-	iov.iov_base = (u64 *) reg;
-	iov.iov_len = sizeof(unsigned long);
-
-	*reg = tar;
-	ret = ptrace(PTRACE_SETREGSET, child, NT_PPC_TAR, &iov);
-	if (ret) {
-		perror("ptrace(PTRACE_SETREGSET) failed");
-		goto fail;
-	}
-
-	*reg = ppr;
-	ret = ptrace(PTRACE_SETREGSET, child, NT_PPC_PPR, &iov);
-	if (ret) {
-		perror("ptrace(PTRACE_SETREGSET) failed");
-		goto fail;
-	}
-
-	*reg = dscr;
-	ret = ptrace(PTRACE_SETREGSET, child, NT_PPC_DSCR, &iov);
-	if (ret) {
-		perror("ptrace(PTRACE_SETREGSET) failed");
-		goto fail;
-	}
-
-	free(reg);
-	return TEST_PASS;
-fail:
-	free(reg);
-	return TEST_FAIL;
-}
+/*
+ * Tracing backends
+ *
+ * Every tracee access goes through the backend owning the pid. The
+ * kernel's ptrace is the default; other backends (the software POWER8
+ * model in sim.h) register themselves and claim their own pids. xfer
+ * follows the ptrace convention of returning -1 with errno set.
+ */
+struct ptrace_backend {
+	const char *name;
+	bool (*owns)(pid_t child);
+	int (*attach)(pid_t child);
+	int (*detach)(pid_t child);
+	int (*cont)(pid_t child);
+	long (*xfer)(pid_t child, const struct snapshot_regset *r, void *buf, bool set);
+};
 
-int show_tm_checkpointed_state(pid_t child, unsigned long *out)
-{
-	struct iovec iov;
-	unsigned long *reg;
-	int ret;
-
-	reg = malloc(sizeof(unsigned long));
-	if (!reg) {
-		perror("malloc() failed");
-		return TEST_FAIL;
-	}
-
-	iov.iov_base = (u64 *) reg;
-	iov.iov_len = sizeof(unsigned long);
-
-	ret = ptrace(PTRACE_GETREGSET, child, NT_PPC_TM_CTAR, &iov);
-	if (ret) {
-		perror("ptrace(PTRACE_GETREGSET) failed");
-		goto fail;
-	}
-	if (out)
-		out[0] = *reg;
-
-	ret = ptrace(PTRACE_GETREGSET, child, NT_PPC_TM_CPPR, &iov);
-	if (ret) {
-		perror("ptrace(PTRACE_GETREGSET) failed");
-		goto fail;
-	}
-	if (out)
-		out[1] = *reg;
-
-	ret = ptrace(PTRACE_GETREGSET, child, NT_PPC_TM_CDSCR, &iov);
-	if (ret) {
-		perror("ptrace(PTRACE_GETREGSET) failed");
-		goto fail;
-	}
-	if (out)
-		out[2] = *reg;
-
-	free(reg);
-	return TEST_PASS;
-
-fail:
-	free(reg);
-	return TEST_FAIL;
-}
+#define BACKEND_MAX	4
 
-int write_ckpt_tar_registers(pid_t child, unsigned long tar, unsigned long ppr, unsigned long dscr)
-{
-	struct iovec iov;
-	unsigned long *reg;
-	int ret;
-
-	reg = malloc(sizeof(unsigned long));
-	if (!reg) {
-		perror("malloc() failed");
-		return TEST_FAIL;
-	}
-
-	iov.iov_base = (u64 *) reg;
-	iov.iov_len = sizeof(unsigned long);
-
-	*reg = tar;
-	ret = ptrace(PTRACE_SETREGSET, child, NT_PPC_TM_CTAR, &iov);
-	if (ret) {
-		perror("ptrace(PTRACE_GETREGSET) failed");
-		goto fail;
-	}
-
-	*reg = ppr;
-	ret = ptrace(PTRACE_SETREGSET, child, NT_PPC_TM_CPPR, &iov);
-	if (ret) {
-		perror("ptrace(PTRACE_GETREGSET) failed");
-		goto fail;
-	}
-
-	*reg = dscr;
-	ret = ptrace(PTRACE_SETREGSET, child, NT_PPC_TM_CDSCR, &iov);
-	if (ret) {
-		perror("ptrace(PTRACE_GETREGSET) failed");
-		goto fail;
-	}
-
-	free(reg);
-	return TEST_PASS;
-fail:
-	free(reg);
-	return TEST_FAIL;
-}
+int ptrace_backend_register(const struct ptrace_backend *b);
 
-/* FPR */
-int show_fpr(pid_t child, unsigned long *fpr)
-{
-	struct fpr_regs *regs;
-	int ret, i;
-
-	regs = (struct fpr_regs *) malloc(sizeof(struct fpr_regs));
-	ret = ptrace(PTRACE_GETFPREGS, child, NULL, regs);
-	if (ret) {
-		perror("ptrace(PTRACE_GETREGSET) failed");
-		return TEST_FAIL;
-	}
-
-	if (fpr) {
-		for (i = 0; i < 32; i++)
-			fpr[i] = regs->fpr[i];
-	}
-	return TEST_PASS;
-}
+/*
+ * Tracer sessions
+ *
+ * The kernel backend seizes a tracee once and keeps it until
+ * stop_trace(). In between, start_trace() brings it to a stop with
+ * PTRACE_INTERRUPT, not SIGSTOP, and does nothing if it is already
+ * stopped. cont_trace() resumes it with PTRACE_LISTEN when it sits in a
+ * group-stop. The tracee's own signals are delivered when it next runs
+ * instead of being taken for the tracer's stop; like any tracee it
+ * waits on them until the tracer next looks. Exec, exit and clone are
+ * reported, and threads it clones are traced too.
+ */
+enum tracee_state {
+	TRACEE_RUNNING,
+	TRACEE_STOPPED,		/* ptrace-stop, registers accessible */
+	TRACEE_LISTENING,	/* group-stop, still reporting */
+	TRACEE_EXITED,
+};
 
-int write_fpr(pid_t child, unsigned long val)
-{
-	struct fpr_regs *regs;
-	int ret, i;
-
-	regs = (struct fpr_regs *) malloc(sizeof(struct fpr_regs));
-	ret = ptrace(PTRACE_GETFPREGS, child, NULL, regs);
-	if (ret) {
-		perror("ptrace(PTRACE_GETREGSET) failed");
-		return TEST_FAIL;
-	}
-
-	for (i = 0; i < 32; i++)
-		regs->fpr[i] = val;
-
-	ret = ptrace(PTRACE_SETFPREGS, child, NULL, regs);
-	if (ret) {
-		perror("ptrace(PTRACE_GETREGSET) failed");
-		return TEST_FAIL;
-	}
-	return TEST_PASS;
-}
+#define SESSION_MAX	16
+
+/* The tracees are the tests' own children, never left behind */
+#define SESSION_OPTIONS	(PTRACE_O_TRACEEXEC | PTRACE_O_TRACEEXIT | \
+			 PTRACE_O_TRACECLONE | PTRACE_O_EXITKILL)
+
+struct trace_session {
+	pid_t pid;
+	enum tracee_state state;
+	int status;		/* from waitpid(), for the last stop */
+	int event;		/* PTRACE_EVENT_* of the last stop, 0 if none */
+	unsigned long events;	/* 1 << PTRACE_EVENT_* seen, for the caller to clear */
+	unsigned long event_msg;	/* PTRACE_GETEVENTMSG, eg. a new thread's tid */
+	int sig;		/* delivered when the tracee next runs */
+	bool group_stop;
+};
 
-int show_ckpt_fpr(pid_t child, unsigned long *fpr)
-{
-	struct fpr_regs *regs;
-	struct iovec iov;
-	int ret, i;
-
-	regs = (struct fpr_regs *) malloc(sizeof(struct fpr_regs));
-	iov.iov_base = regs;
-	iov.iov_len = sizeof(struct fpr_regs);
-
-	ret = ptrace(PTRACE_GETREGSET, child, NT_PPC_TM_CFPR, &iov);
-	if (ret) {
-		perror("ptrace(PTRACE_GETREGSET) failed");
-		return TEST_FAIL;
-	}
-
-	if (fpr) {
-		for (i = 0; i < 32; i++)
-			fpr[i] = regs->fpr[i];
-	}
-
-	return TEST_PASS;
-}
+struct trace_session *trace_session(pid_t child);
 
-int write_ckpt_fpr(pid_t child, unsigned long val)
-{
-	struct fpr_regs *regs;
-	struct iovec iov;
-	int ret, i;
-
-	regs = (struct fpr_regs *) malloc(sizeof(struct fpr_regs));
-	iov.iov_base = regs;
-	iov.iov_len = sizeof(struct fpr_regs);
-
-	ret = ptrace(PTRACE_GETREGSET, child, NT_PPC_TM_CFPR, &iov);
-	if (ret) {
-		perror("ptrace(PTRACE_GETREGSET) failed");
-		return TEST_FAIL;
-	}
-
-	for (i = 0; i < 32; i++)
-		regs->fpr[i] = val;
-
-	ret = ptrace(PTRACE_SETREGSET, child, NT_PPC_TM_CFPR, &iov);
-	if (ret) {
-		perror("ptrace(PTRACE_GETREGSET) failed");
-		return TEST_FAIL;
-	}
-	return TEST_PASS;
-}
+/* Move one regset between the tracee and buf, through its backend */
+long regset_xfer(pid_t child, const struct snapshot_regset *r, void *buf, bool set);
 
-/* GPR */
-int show_gpr(pid_t child, unsigned long *gpr)
-{
-	struct pt_regs *regs;
-	int ret, i;
-
-	regs = (struct pt_regs *) malloc(sizeof(struct pt_regs));
-	if (!regs) {
-		perror("malloc() failed");
-		return TEST_FAIL;
-	}
-
-	ret = ptrace(PTRACE_GETREGS, child, NULL, regs);
-	if (ret) {
-		perror("ptrace(PTRACE_GETREGSET) failed");
-		return TEST_FAIL;
-	}
-
-	if (gpr) {
-		for (i = 14; i < 32; i++)
-			gpr[i-14] = regs->gpr[i];
-	}
-
-	return TEST_PASS;
-}
+/* perror() for a failed regset_xfer(), naming the backend and regset */
+void regset_perror(pid_t child, const struct snapshot_regset *r, bool set);
 
-int write_gpr(pid_t child, unsigned long val)
+static inline const struct snapshot_regset *regset_lookup(unsigned long flag)
 {
-	struct pt_regs *regs;
-	int i, ret;
-
-	regs = (struct pt_regs *) malloc(sizeof(struct pt_regs));
-	if (!regs) {
-		perror("malloc() failed");
-		return TEST_FAIL;
-	}
-
-	ret = ptrace(PTRACE_GETREGS, child, NULL, regs);
-	if (ret) {
-		perror("ptrace(PTRACE_GETREGSET) failed");
-		return TEST_FAIL;
-	}
-
-	for (i = 14; i < 32; i++)
-		regs->gpr[i] = val;
-
-	ret = ptrace(PTRACE_SETREGS, child, NULL, regs);
-	if (ret) {
-		perror("ptrace(PTRACE_GETREGSET) failed");
-		return TEST_FAIL;
-	}
-	return TEST_PASS;
+	return &snapshot_regsets[__builtin_ctzl(flag)];
 }
 
-int show_ckpt_gpr(pid_t child, unsigned long *gpr)
-{
-	struct pt_regs *regs;
-	struct iovec iov;
-	int ret, i;
-
-	regs = (struct pt_regs *) malloc(sizeof(struct pt_regs));
-	if (!regs) {
-		perror("malloc() failed");
-		return TEST_FAIL;
-	}
-
-	iov.iov_base = (u64 *) regs;
-	iov.iov_len = sizeof(struct pt_regs);
-
-	ret = ptrace(PTRACE_GETREGSET, child, NT_PPC_TM_CGPR, &iov);
-	if (ret) {
-		perror("ptrace(PTRACE_GETREGSET) failed");
-		return TEST_FAIL;
-	}
-
-	if (gpr) {
-		for (i = 14; i < 32; i++)
-			gpr[i-14] = regs->gpr[i];
-	}
-
-	return TEST_PASS;
-}
+/*
+ * Per-stop regset cache
+ *
+ * A tracer that registers a cache for a tracee gets each regset fetched
+ * once per stop, on first use, by the show_*() and write_*() helpers.
+ * Writes only update the cached copy and mark it dirty; everything dirty
+ * is written back in one pass by cont_trace() or stop_trace(), which
+ * also drop the cached state since the tracee is about to run again.
+ */
+#define REGCACHE_MAX	16
 
-int write_ckpt_gpr(pid_t child, unsigned long val)
-{
-	struct pt_regs *regs;
-	struct iovec iov;
-	int ret, i;
-
-	regs = (struct pt_regs *) malloc(sizeof(struct pt_regs));
-	if (!regs) {
-		perror("malloc() failed\n");
-		return TEST_FAIL;
-	}
-	iov.iov_base = (u64 *) regs;
-	iov.iov_len = sizeof(struct pt_regs);
-
-	ret = ptrace(PTRACE_GETREGSET, child, NT_PPC_TM_CGPR, &iov);
-	if (ret) {
-		perror("ptrace(PTRACE_GETREGSET) failed");
-		return TEST_FAIL;
-	}
-
-	for (i = 14; i < 32; i++)
-		regs->gpr[i] = val;
-
-	ret = ptrace(PTRACE_SETREGSET, child, NT_PPC_TM_CGPR, &iov);
-	if (ret) {
-		perror("ptrace(PTRACE_GETREGSET) failed");
-		return TEST_FAIL;
-	}
-	return TEST_PASS;
-}
+struct regset_cache {
+	pid_t pid;
+	unsigned long valid;
+	unsigned long dirty;
+	struct reg_snapshot regs;
+};
 
-/* VMX */
-int show_vmx(pid_t child, unsigned long vmx[][2])
-{
-	int ret;
-
-	ret = ptrace(PTRACE_GETVRREGS, child, 0, vmx);
-	if (ret) {
-		perror("ptrace(PTRACE_GETVRREGS) failed");
-		return TEST_FAIL;
-	}
-	return TEST_PASS;
-}
+int regcache_attach(struct regset_cache *cache, pid_t child);
+void regcache_detach(struct regset_cache *cache);
+void *regcache_get(struct regset_cache *cache, unsigned long flag);
+int regcache_flush(struct regset_cache *cache);
 
-int show_vmx_ckpt(pid_t child, unsigned long vmx[][2])
-{
-	unsigned long regs[34][2];
-	struct iovec iov;
-	int ret;
-
-	iov.iov_base = (u64 *) regs;
-	iov.iov_len = sizeof(regs);
-	ret = ptrace(PTRACE_GETREGSET, child, NT_PPC_TM_CVMX, &iov);
-	if (ret) {
-		perror("ptrace(PTRACE_GETREGSET, NT_PPC_TM_CVMX) failed");
-		return TEST_FAIL;
-	}
-	memcpy(vmx, regs, sizeof(regs));
-	return TEST_PASS;
-}
+/* Basic ptrace operations */
+int start_trace(pid_t child);
+int stop_trace(pid_t child);
+int cont_trace(pid_t child);
 
+/*
+ * For tracers that let the tracee run into its own traps: wait for the
+ * next stop, which trace_session() then describes. A signal delivery
+ * stop leaves the signal in ->sig, to be delivered by the next
+ * cont_trace() unless the tracer clears it. Kernel backend only.
+ */
+int wait_trace(pid_t child);
 
-int write_vmx(pid_t child, unsigned long vmx[][2])
-{
-	int ret;
-
-	ret = ptrace(PTRACE_SETVRREGS, child, 0, vmx);
-	if (ret) {
-		perror("ptrace(PTRACE_SETVRREGS) failed");
-		return TEST_FAIL;
-	}
-	return TEST_PASS;
-}
+/* Kill a tracee and reap it, seized or not */
+int kill_trace(pid_t child);
 
-int write_vmx_ckpt(pid_t child, unsigned long vmx[][2])
-{
-	unsigned long regs[34][2];
-	struct iovec iov;
-	int ret;
-
-	memcpy(regs, vmx, sizeof(regs));
-	iov.iov_base = (u64 *) regs;
-	iov.iov_len = sizeof(regs);
-	ret = ptrace(PTRACE_SETREGSET, child, NT_PPC_TM_CVMX, &iov);
-	if (ret) {
-		perror("ptrace(PTRACE_SETREGSET, NT_PPC_TM_CVMX) failed");
-		return TEST_FAIL;
-	}
-	return TEST_PASS;
-}
+/* Like cont_trace(), for a single instruction. Kernel backend only. */
+int step_trace(pid_t child);
 
-/* VSX */
-int show_vsx(pid_t child, unsigned long *vsx)
-{
-	int ret;
-
-	ret = ptrace(PTRACE_GETVSRREGS, child, 0, vsx);
-	if (ret) {
-		perror("ptrace(PTRACE_GETVSRREGS) failed");
-		return TEST_FAIL;
-	}
-	return TEST_PASS;
-}
+/*
+ * The regset layouts as the kernel has them. The show_*() and write_*()
+ * helpers below keep their buffers in the caller, on their own stack or
+ * in the regset cache, so nothing is allocated on the tracing path.
+ */
+_Static_assert(sizeof(struct ebb_regs) == 3 * 8, "NT_PPC_EBB layout");
+_Static_assert(sizeof(struct pmu_regs) == 5 * 8, "NT_PPC_PMU layout");
+_Static_assert(sizeof(struct fpr_regs) == 33 * 8, "NT_PPC_TM_CFPR layout");
+_Static_assert(sizeof(struct vmx_regs) == 34 * 16, "NT_PPC_TM_CVMX layout");
+_Static_assert(sizeof(struct vsx_regs) == 32 * 8, "NT_PPC_TM_CVSX layout");
+_Static_assert(sizeof(struct tm_spr_regs) == 3 * 8, "NT_PPC_TM_SPR layout");
 
-int show_vsx_ckpt(pid_t child, unsigned long *vsx)
-{
-	unsigned long regs[32];
-	struct iovec iov;
-	int ret;
-
-	iov.iov_base = (u64 *) regs;
-	iov.iov_len = sizeof(regs);
-	ret = ptrace(PTRACE_GETREGSET, child, NT_PPC_TM_CVSX, &iov);
-	if (ret) {
-		perror("ptrace(PTRACE_GETREGSET, NT_PPC_TM_CVSX) failed");
-		return TEST_FAIL;
-	}
-	memcpy(vsx, regs, sizeof(regs));
-	return TEST_PASS;
-}
+/* EBB */
+int show_ebb_registers(pid_t child, struct ebb_regs *regs);
 
-int write_vsx(pid_t child, unsigned long *vsx)
-{
-	int ret;
-
-	ret = ptrace(PTRACE_SETVSRREGS, child, 0, vsx);
-	if (ret) {
-		perror("ptrace(PTRACE_SETVSRREGS) failed");
-		return TEST_FAIL;
-	}
-	return TEST_PASS;
-}
+/* TAR, PPR, DSCR */
+int show_tar_registers(pid_t child, unsigned long *out);
+int write_tar_registers(pid_t child, unsigned long tar, unsigned long ppr, unsigned long dscr);
+int show_tm_checkpointed_state(pid_t child, unsigned long *out);
+int write_ckpt_tar_registers(pid_t child, unsigned long tar, unsigned long ppr, unsigned long dscr);
 
-int write_vsx_ckpt(pid_t child, unsigned long *vsx)
-{
-	unsigned long regs[32];
-	struct iovec iov;
-	int ret;
-
-	memcpy(regs, vsx, sizeof(regs));
-	iov.iov_base = (u64 *) regs;
-	iov.iov_len = sizeof(regs);
-	ret = ptrace(PTRACE_SETREGSET, child, NT_PPC_TM_CVSX, &iov);
-	if (ret) {
-		perror("ptrace(PTRACE_SETREGSET, NT_PPC_TM_CVSX) failed");
-		return TEST_FAIL;
-	}
-	return TEST_PASS;
-}
+/* FPR */
+int show_fpr(pid_t child, unsigned long *fpr);
+int write_fpr(pid_t child, unsigned long val);
+int show_ckpt_fpr(pid_t child, unsigned long *fpr);
+int write_ckpt_fpr(pid_t child, unsigned long val);
+
+/* GPR - only the non volatile r14-r31 are shown and written */
+int show_gpr(pid_t child, unsigned long *gpr);
+int write_gpr(pid_t child, unsigned long val);
+int show_ckpt_gpr(pid_t child, unsigned long *gpr);
+int write_ckpt_gpr(pid_t child, unsigned long val);
+
+/* VMX - vmx[] must hold 34 entries (VR0-31, VSCR, VRSAVE) */
+int show_vmx(pid_t child, unsigned long vmx[][2]);
+int show_vmx_ckpt(pid_t child, unsigned long vmx[][2]);
+int write_vmx(pid_t child, unsigned long vmx[][2]);
+int write_vmx_ckpt(pid_t child, unsigned long vmx[][2]);
+
+/* VSX - vsx[] must hold 32 entries (low doublewords of VSR0-31) */
+int show_vsx(pid_t child, unsigned long *vsx);
+int show_vsx_ckpt(pid_t child, unsigned long *vsx);
+int write_vsx(pid_t child, unsigned long *vsx);
+int write_vsx_ckpt(pid_t child, unsigned long *vsx);
 
 /* TM SPR */
-int show_tm_spr(pid_t child, struct tm_spr_regs *out)
-{
-	struct tm_spr_regs *regs;
-	struct iovec iov;
-	int ret;
-
-	regs = (struct tm_spr_regs *) malloc(sizeof(struct tm_spr_regs));
-	if (!regs) {
-		perror("malloc() failed");
-		return TEST_FAIL;
-	}
-
-	iov.iov_base = (u64 *) regs;
-	iov.iov_len = sizeof(struct tm_spr_regs);
-
-	ret = ptrace(PTRACE_GETREGSET, child, NT_PPC_TM_SPR, &iov);
-	if (ret) {
-		perror("ptrace(PTRACE_GETREGSET) failed");
-		return TEST_FAIL;
-	}
-
-	if (out)
-		memcpy(out, regs, sizeof(struct tm_spr_regs));
-
-	return TEST_PASS;
-}
-
+int show_tm_spr(pid_t child, struct tm_spr_regs *out);
 
+/*
+ * Capture every regset the CPU supports into a caller owned snapshot,
+ * one syscall per regset and no allocation. Regsets the kernel has no
+ * data for (EBB unused, tracee not in a transaction) are left out of
+ * snap->valid rather than failing the snapshot.
+ */
+int snapshot_all(pid_t child, struct reg_snapshot *snap);
 
-/* Analyse TEXASR after TM failure */
-inline unsigned long get_tfiar(void)
-{
-	unsigned long ret;
-
-	asm volatile("mfspr %0,%1" : "=r" (ret): "i" (SPRN_TFIAR));
-	return ret;
-}
-
-void analyse_texasr(unsigned long texasr)
-{
-	printf("TEXASR: %16lx\t", texasr);
-
-	if (texasr & TEXASR_FP)
-		printf("TEXASR_FP  ");
-
-	if (texasr & TEXASR_DA)
-		printf("TEXASR_DA  ");
-
-	if (texasr & TEXASR_NO)
-		printf("TEXASR_NO  ");
-
-	if (texasr & TEXASR_FO)
-		printf("TEXASR_FO  ");
-
-	if (texasr & TEXASR_SIC)
-		printf("TEXASR_SIC  ");
-
-	if (texasr & TEXASR_NTC)
-		printf("TEXASR_NTC  ");
-
-	if (texasr & TEXASR_TC)
-		printf("TEXASR_TC  ");
-
-	if (texasr & TEXASR_TIC)
-		printf("TEXASR_TIC  ");
-
-	if (texasr & TEXASR_IC)
-		printf("TEXASR_IC  ");
-
-	if (texasr & TEXASR_IFC)
-		printf("TEXASR_IFC  ");
-
-	if (texasr & TEXASR_ABT)
-		printf("TEXASR_ABT  ");
-
-	if (texasr & TEXASR_SPD)
-		printf("TEXASR_SPD  ");
-
-	if (texasr & TEXASR_HV)
-		printf("TEXASR_HV  ");
-
-	if (texasr & TEXASR_PR)
-		printf("TEXASR_PR  ");
-
-	if (texasr & TEXASR_FS)
-		printf("TEXASR_FS  ");
-
-	if (texasr & TEXASR_TE)
-		printf("TEXASR_TE  ");
-
-	if (texasr & TEXASR_ROT)
-		printf("TEXASR_ROT  ");
-
-	printf("TFIAR :%lx\n", get_tfiar());
-}
+/*
+ * Snapshot diff
+ *
+ * Compares two register files slot by slot. Each differing slot sets
+ * its bit in the class mask and leaves the XOR of both values in the
+ * matching *_bits entry, so callers see exactly which bits changed.
+ * Equal data, the common case on a healthy kernel, is skipped a vector
+ * at a time.
+ */
+#define DIFF_SPR_CTR	0x01
+#define DIFF_SPR_LR	0x02
+#define DIFF_SPR_XER	0x04
+#define DIFF_SPR_CR	0x08
+#define DIFF_SPR_TAR	0x10
+#define DIFF_SPR_PPR	0x20
+#define DIFF_SPR_DSCR	0x40
+#define DIFF_NR_SPRS	7
+
+struct reg_diff {
+	unsigned long gpr;		/* GPR0-31 */
+	unsigned long fpr;		/* FPR0-31, bit 32 is FPSCR */
+	unsigned long vmx;		/* VR0-31, bit 32 VSCR, bit 33 VRSAVE */
+	unsigned long vsx;		/* VSR0-31 low doublewords */
+	unsigned long spr;		/* DIFF_SPR_* */
+	unsigned long gpr_bits[32];
+	unsigned long fpr_bits[33];
+	unsigned long vmx_bits[34][2];
+	unsigned long vsx_bits[32];
+	unsigned long spr_bits[DIFF_NR_SPRS];
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+int reg_set_diff(const struct reg_set *a, const struct reg_set *b,
+		 unsigned long which, struct reg_diff *d);
+
+/* Same classes of two snapshots, restricted to what both captured */
+int snapshot_diff(const struct reg_snapshot *a, const struct reg_snapshot *b,
+		  struct reg_diff *live, struct reg_diff *ckpt);
+
+/* Running against checkpointed state of the same stop */
+int snapshot_diff_ckpt(const struct reg_snapshot *snap, struct reg_diff *d);
+void reg_diff_print(const char *prefix, const struct reg_diff *d);
+
+#endif /* _PTRACE_H */
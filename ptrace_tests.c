@@ -0,0 +1,147 @@
+/*
+ * Ptrace TM test driver
+ *
+ * Runs the tests that the files linked into it registered with
+ * TEST_REGISTER(), each in its own forked child.
+ *
+ *   ptrace_tests [-l] [-j jobs | -r repeat] [-n cycles[k|m] [-t threads]
+ *                [-f text|json|subunit]] [pattern...]
+ *
+ * -l lists the tests and patterns (fnmatch(3), eg. "?pr") pick some of
+ * them. -j runs up to jobs of them at once, each on a CPU of its own
+ * (see test_harness_parallel(), 0 for one per CPU). -r runs each one
+ * repeat times under a single test record. -n, -t and -f run the
+ * stress mode of the tests that have one instead, see tm_stress.h.
+ *
+ * Licensed under GPLv2.
+ */
+#include <fnmatch.h>
+
+#include "tm_stress.h"
+
+static const struct harness_test *current;
+static struct tm_stress_opts stress_opts;
+static int repeat = 1;
+
+static bool selected(const struct harness_test *t, char **patterns, int nr)
+{
+	int i;
+
+	if (!nr)
+		return true;
+	for (i = 0; i < nr; i++)
+		if (!fnmatch(patterns[i], t->name, 0))
+			return true;
+	return false;
+}
+
+/* Every run in a child of its own, reported as one test */
+static int run_repeated(void)
+{
+	int i, rc, failed = 0, skipped = 0;
+	u64 start = monotonic_ns();
+
+	for (i = 0; i < repeat; i++) {
+		rc = run_test(current->function, current->name);
+		if (rc == MAGIC_SKIP_RETURN_VALUE)
+			skipped++;
+		else if (rc)
+			failed++;
+	}
+
+	printf("%s: %d runs, %d failed, %d skipped, %llu us per run\n",
+	       current->name, repeat, failed, skipped,
+	       (monotonic_ns() - start) / 1000 / repeat);
+	if (skipped == repeat)
+		return MAGIC_SKIP_RETURN_VALUE;
+	return failed ? TEST_FAIL : TEST_PASS;
+}
+
+static int run_stress(void)
+{
+	return current->stress(&stress_opts);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-l] [-j jobs | -r repeat] [-n cycles[k|m] [-t threads] "
+		"[-f text|json|subunit]] [pattern...]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	const struct harness_test *t;
+	struct harness_test *tests = NULL;
+	int c, rc, jobs = -1, matched = 0, failed = 0;
+	bool list = false;
+
+	tm_stress_defaults(&stress_opts);
+
+	while ((c = getopt(argc, argv, "lj:r:n:t:f:")) != -1) {
+		switch (c) {
+		case 'l':
+			list = true;
+			break;
+		case 'j':
+			jobs = atoi(optarg);
+			break;
+		case 'r':
+			repeat = atoi(optarg);
+			if (repeat < 1)
+				repeat = 1;
+			break;
+		default:
+			if (tm_stress_option(c, optarg, &stress_opts))
+				usage(argv[0]);
+		}
+	}
+
+	/* The jobs run the plain test functions, nothing else */
+	if (jobs >= 0 && (repeat > 1 || stress_opts.cycles))
+		usage(argv[0]);
+	if (jobs >= 0 && !list) {
+		tests = calloc(__stop_harness_tests - __start_harness_tests, sizeof(*tests));
+		if (!tests) {
+			perror("calloc");
+			return 1;
+		}
+	}
+
+	for_each_test(t) {
+		if (!selected(t, argv + optind, argc - optind))
+			continue;
+		if (stress_opts.cycles && !t->stress)
+			continue;
+		matched++;
+
+		if (list) {
+			printf("%s%s\n", t->name, t->stress ? " (stress)" : "");
+			continue;
+		}
+		if (tests) {
+			tests[matched - 1] = *t;
+			continue;
+		}
+
+		current = t;
+		if (stress_opts.cycles)
+			rc = test_harness(run_stress, t->name);
+		else if (repeat > 1)
+			rc = test_harness(run_repeated, t->name);
+		else
+			rc = test_harness(t->function, t->name);
+		if (rc && rc != MAGIC_SKIP_RETURN_VALUE)
+			failed++;
+	}
+
+	if (!matched) {
+		fprintf(stderr, "No test matches\n");
+		return 1;
+	}
+	if (tests) {
+		failed = test_harness_parallel(tests, matched, jobs);
+		free(tests);
+	}
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,371 @@
+/*
+ * Ptrace regset latency benchmark
+ *
+ * Attaches to a parked tracee and times every regset accessor, get and
+ * set (writing back what was read), first with the tracee outside a
+ * transaction and then parked in a suspended one. Prints min, p50, p99,
+ * max and calls per second for each, and with -o writes the same as tab
+ * separated lines to diff across kernels. Last comes a check's read,
+ * write and re-read of the GPRs, through the regset cache and without,
+ * and the round trip through the rendezvous the tracee parks on.
+ *
+ *   regset_bench [-n iterations] [-o file] [-s]
+ *
+ * -s runs against the software POWER8 model (sim.h) instead.
+ *
+ * Licensed under GPLv2.
+ */
+#include <sys/utsname.h>
+
+#include "rendezvous.h"
+#include "sim.h"
+
+#define BENCH_ITERATIONS	10000
+
+static int iterations = BENCH_ITERATIONS;
+static const char *out_path;
+static bool use_sim;
+
+static u64 *samples;
+static FILE *out;
+
+static int cmp_u64(const void *a, const void *b)
+{
+	u64 x = *(const u64 *)a, y = *(const u64 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Sorts samples[], total is their sum */
+static void bench_report(const char *mode, const char *name, const char *op, u64 total)
+{
+	qsort(samples, iterations, sizeof(*samples), cmp_u64);
+
+	printf("%-9s %-8s %s  min %6llu  p50 %6llu  p99 %6llu  max %8llu ns  %9.0f/s\n",
+	       mode, name, op, samples[0], samples[iterations / 2],
+	       samples[iterations * 99 / 100], samples[iterations - 1],
+	       total ? iterations * 1e9 / total : 0);
+	if (out)
+		fprintf(out, "%s\t%s\t%s\t%d\t%llu\t%llu\t%llu\t%llu\t%.0f\n",
+			mode, name, op, iterations, samples[0], samples[iterations / 2],
+			samples[iterations * 99 / 100], samples[iterations - 1],
+			total ? iterations * 1e9 / total : 0);
+}
+
+/* Time one accessor, 1 if the tracee has nothing for it */
+static int bench_one(pid_t child, const char *mode,
+		     const struct snapshot_regset *r, bool set)
+{
+	struct reg_snapshot buf;
+	void *p = (char *)&buf + r->offset;
+	const char *op = set ? "set" : "get";
+	u64 start, total = 0;
+	int i;
+
+	/* Reads fill the buffer that the sets write back */
+	if (regset_xfer(child, r, p, false)) {
+		if (errno == ENODATA || errno == ENODEV)
+			return 1;
+		regset_perror(child, r, false);
+		return -1;
+	}
+
+	for (i = 0; i < iterations; i++) {
+		start = monotonic_ns();
+		if (regset_xfer(child, r, p, set)) {
+			regset_perror(child, r, set);
+			return -1;
+		}
+		samples[i] = monotonic_ns() - start;
+		total += samples[i];
+	}
+
+	bench_report(mode, r->name, op, total);
+	return 0;
+}
+
+/*
+ * What a check does at a stop: read the GPRs, write them and read them
+ * back. With a regset cache attached that is one get, and one set at
+ * the flush; without, every call goes to the tracee.
+ */
+static int bench_rmw(pid_t child, const char *mode, bool cached)
+{
+	struct regset_cache cache;
+	unsigned long gpr[18], val;
+	u64 start, total = 0;
+	int i, ret = TEST_PASS;
+
+	if (cached && regcache_attach(&cache, child))
+		return TEST_FAIL;
+
+	for (i = 0; i < iterations; i++) {
+		start = monotonic_ns();
+		if (show_gpr(child, gpr)) {
+			ret = TEST_FAIL;
+			break;
+		}
+		val = gpr[0] + 1;
+		if (write_gpr(child, val) || show_gpr(child, gpr) ||
+		    (cached && regcache_flush(&cache))) {
+			ret = TEST_FAIL;
+			break;
+		}
+		samples[i] = monotonic_ns() - start;
+		total += samples[i];
+
+		if (gpr[17] != val) {
+			printf("%s: r31 %lx after writing %lx\n", mode, gpr[17], val);
+			ret = TEST_FAIL;
+			break;
+		}
+	}
+
+	if (cached)
+		regcache_detach(&cache);
+	if (!ret)
+		bench_report(mode, "gpr", cached ? "rmw_cached" : "rmw", total);
+	return ret;
+}
+
+static int bench_all(pid_t child, const char *mode)
+{
+	const struct snapshot_regset *r;
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(snapshot_regsets); i++) {
+		r = &snapshot_regsets[i];
+		if (!have_hwcap(r->hwcap) || !have_hwcap2(r->hwcap2))
+			continue;
+
+		switch (bench_one(child, mode, r, false)) {
+		case 1:
+			printf("%-9s %-8s no data\n", mode, r->name);
+			continue;
+		case -1:
+			return TEST_FAIL;
+		}
+		if (bench_one(child, mode, r, true) < 0)
+			return TEST_FAIL;
+	}
+
+	if (bench_rmw(child, mode, false) || bench_rmw(child, mode, true))
+		return TEST_FAIL;
+	return TEST_PASS;
+}
+
+/*
+ * Hardware tracee: optionally enters a suspended transaction, then
+ * posts on the rendezvous and sleeps until the benchmark is done.
+ */
+static void park(struct rendezvous *r, bool suspended)
+{
+	int in_tx = 0;
+
+	if (suspended) {
+#ifdef __powerpc__
+		asm volatile(TBEGIN
+			     "beq 1f;"
+			     TSUSPEND
+			     "li %0, 1;"
+			     "1: ;"
+			     : "+r" (in_tx) : : "cr0", "memory");
+#endif
+		if (!in_tx)
+			_exit(1);
+	}
+
+	rendezvous_arrive(r);
+	_exit(0);
+}
+
+static int bench_hw(const char *mode, bool suspended)
+{
+	struct rendezvous *r;
+	int ret = TEST_FAIL;
+	u32 seen = 0;
+	pid_t pid;
+
+	r = rendezvous_create();
+	if (!r)
+		return TEST_FAIL;
+
+	/* Nothing buffered may reach the child, or it comes out twice */
+	fflush(NULL);
+	pid = fork();
+	if (pid == -1) {
+		perror("fork");
+		goto out;
+	}
+	if (pid == 0)
+		park(r, suspended);
+
+	while (rendezvous_wait(r, &seen, 100))
+		if (waitpid(pid, NULL, WNOHANG) == pid) {
+			printf("%s: tracee could not park\n", mode);
+			goto out;
+		}
+
+	if (start_trace(pid) == TEST_PASS)
+		ret = bench_all(pid, mode);
+
+	kill_trace(pid);
+out:
+	rendezvous_destroy(r);
+	return ret;
+}
+
+/*
+ * A tracee arriving at the rendezvous over and over: how long from its
+ * post to the tracer seeing it, releasing it and seeing the next one.
+ */
+static int bench_rendezvous(void)
+{
+	struct rendezvous *r;
+	int i, status, ret = TEST_FAIL;
+	u32 seen = 0;
+	u64 start, total = 0;
+	pid_t pid;
+
+	r = rendezvous_create();
+	if (!r)
+		return TEST_FAIL;
+
+	/* As in bench_hw() */
+	fflush(NULL);
+	pid = fork();
+	if (pid == -1) {
+		perror("fork");
+		goto out;
+	}
+	if (pid == 0) {
+		for (i = 0; i <= iterations; i++)
+			rendezvous_arrive(r);
+		_exit(0);
+	}
+
+	if (rendezvous_wait(r, &seen, 1000))
+		goto kill;
+	for (i = 0; i < iterations; i++) {
+		start = monotonic_ns();
+		rendezvous_release(r, seen);
+		if (rendezvous_wait(r, &seen, 1000))
+			goto kill;
+		samples[i] = monotonic_ns() - start;
+		total += samples[i];
+	}
+	rendezvous_release(r, seen);
+
+	if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status))
+		printf("rendezvous: tracee did not exit cleanly\n");
+	else
+		ret = TEST_PASS;
+	if (seen != iterations + 1) {
+		printf("rendezvous: %u stops, expected %d\n", seen, iterations + 1);
+		ret = TEST_FAIL;
+	}
+	if (!ret)
+		bench_report("-", "rendezvous", "round_trip", total);
+	goto out;
+
+kill:
+	printf("rendezvous: tracee stopped posting\n");
+	kill(pid, SIGKILL);
+	waitpid(pid, NULL, 0);
+out:
+	rendezvous_destroy(r);
+	return ret;
+}
+
+static int sim_tracer(pid_t child, void *arg)
+{
+	return bench_all(child, arg);
+}
+
+static int bench_sim(void)
+{
+	struct sim_cpu cpu;
+	int ret;
+
+	if (sim_cpu_init(&cpu))
+		return TEST_FAIL;
+	cpu.tracer = sim_tracer;
+
+	cpu.tracer_arg = "idle";
+	sim_break(&cpu);
+
+	cpu.tracer_arg = "suspended";
+	sim_tbegin(&cpu);
+	sim_tsuspend(&cpu);
+	sim_break(&cpu);
+	sim_tresume(&cpu);
+
+	ret = cpu.tracer_status;
+	sim_cpu_fini(&cpu);
+	return ret;
+}
+
+static int regset_bench(void)
+{
+	struct utsname u;
+	int ret;
+
+	samples = malloc(iterations * sizeof(*samples));
+	if (!samples) {
+		perror("malloc");
+		return TEST_FAIL;
+	}
+
+	if (out_path) {
+		out = fopen(out_path, "w");
+		if (!out) {
+			perror(out_path);
+			return TEST_FAIL;
+		}
+		uname(&u);
+		fprintf(out, "# kernel %s %s, backend %s, git %s\n", u.release,
+			u.machine, use_sim ? "sim" : "ptrace", GIT_VERSION);
+		fprintf(out, "# mode\tregset\top\titerations\tmin_ns\tp50_ns\tp99_ns\tmax_ns\tcalls_per_s\n");
+	}
+
+	if (use_sim) {
+		ret = bench_sim();
+	} else {
+		ret = bench_hw("idle", false);
+		if (!ret && cpu_caps.htm)
+			ret = bench_hw("suspended", true);
+	}
+	if (!ret)
+		ret = bench_rendezvous();
+
+	if (out)
+		fclose(out);
+	free(samples);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	int c;
+
+	while ((c = getopt(argc, argv, "n:o:s")) != -1) {
+		switch (c) {
+		case 'n':
+			iterations = atoi(optarg);
+			break;
+		case 'o':
+			out_path = optarg;
+			break;
+		case 's':
+			use_sim = true;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-n iterations] [-o file] [-s]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (iterations < 1)
+		iterations = 1;
+
+	return test_harness(regset_bench, "regset_bench");
+}
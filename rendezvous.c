@@ -0,0 +1,96 @@
+/*
+ * Tracer/tracee rendezvous without spinning, see rendezvous.h
+ *
+ * Licensed under GPLv2.
+ */
+#define _GNU_SOURCE	/* For memfd_create */
+
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "rendezvous.h"
+
+static long futex(u32 *uaddr, int op, u32 val, const struct timespec *timeout)
+{
+	return syscall(SYS_futex, uaddr, op, val, timeout, NULL, 0);
+}
+
+struct rendezvous *rendezvous_create(void)
+{
+	struct rendezvous *r;
+	int fd;
+
+	fd = memfd_create("rendezvous", MFD_CLOEXEC);
+	if (fd == -1) {
+		perror("memfd_create");
+		return NULL;
+	}
+	if (ftruncate(fd, sizeof(*r))) {
+		perror("ftruncate");
+		close(fd);
+		return NULL;
+	}
+
+	r = mmap(NULL, sizeof(*r), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (r == MAP_FAILED) {
+		perror("mmap");
+		return NULL;
+	}
+	return r;
+}
+
+void rendezvous_destroy(struct rendezvous *r)
+{
+	munmap(r, sizeof(*r));
+}
+
+/* Tracee: announce a new stop without waiting for it, returns its number */
+static u32 rendezvous_post(struct rendezvous *r)
+{
+	u32 seq = __atomic_add_fetch(&r->seq, 1, __ATOMIC_RELEASE);
+
+	futex(&r->seq, FUTEX_WAKE, INT_MAX, NULL);
+	return seq;
+}
+
+void rendezvous_arrive(struct rendezvous *r)
+{
+	u32 seq = rendezvous_post(r);
+	u32 ack;
+
+	for (;;) {
+		ack = __atomic_load_n(&r->ack, __ATOMIC_ACQUIRE);
+		if (ack == seq)
+			break;
+		futex(&r->ack, FUTEX_WAIT, ack, NULL);
+	}
+}
+
+int rendezvous_wait(struct rendezvous *r, u32 *seen, int timeout_ms)
+{
+	struct timespec ts = {
+		.tv_sec = timeout_ms / 1000,
+		.tv_nsec = timeout_ms % 1000 * 1000000L,
+	};
+	u32 seq;
+
+	for (;;) {
+		seq = __atomic_load_n(&r->seq, __ATOMIC_ACQUIRE);
+		if (seq != *seen) {
+			*seen = seq;
+			return 0;
+		}
+		if (futex(&r->seq, FUTEX_WAIT, seq, timeout_ms < 0 ? NULL : &ts) &&
+		    errno == ETIMEDOUT)
+			return -1;
+	}
+}
+
+void rendezvous_release(struct rendezvous *r, u32 seq)
+{
+	__atomic_store_n(&r->ack, seq, __ATOMIC_RELEASE);
+	futex(&r->ack, FUTEX_WAKE, INT_MAX, NULL);
+}
@@ -0,0 +1,43 @@
+/*
+ * Tracer/tracee rendezvous without spinning
+ *
+ * Two sequence counters in a shared memfd mapping, each waited on with
+ * a futex. The tracee bumps seq once its state is loaded ("inspect
+ * now") and sleeps until the tracer copies seq into ack ("done,
+ * resume"). Neither side burns a hardware thread while it waits,
+ * which matters with the transaction's SMT siblings on the same core.
+ *
+ * The mapping is inherited across fork(); its memfd is closed as soon
+ * as it is mapped.
+ *
+ * Licensed under GPLv2.
+ */
+#ifndef _RENDEZVOUS_H
+#define _RENDEZVOUS_H
+
+#include "ptrace.h"
+
+/* The counters live on their own lines, each written by one side only */
+struct rendezvous {
+	u32 seq __attribute__((aligned(CACHE_LINE_SIZE)));	/* tracee */
+	u32 ack __attribute__((aligned(CACHE_LINE_SIZE)));	/* tracer */
+};
+
+/* NULL on failure */
+struct rendezvous *rendezvous_create(void);
+void rendezvous_destroy(struct rendezvous *r);
+
+/* Tracee: announce a new stop and sleep until the tracer releases it */
+void rendezvous_arrive(struct rendezvous *r);
+
+/*
+ * Tracer: sleep until the tracee posts a stop after *seen, and update
+ * *seen to it. Gives up after timeout_ms, or never if negative, and
+ * returns -1 with errno ETIMEDOUT.
+ */
+int rendezvous_wait(struct rendezvous *r, u32 *seen, int timeout_ms);
+
+/* Tracer: let the tracee go on from stop seq */
+void rendezvous_release(struct rendezvous *r, u32 seq);
+
+#endif /* _RENDEZVOUS_H */
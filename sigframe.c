@@ -0,0 +1,152 @@
+/*
+ * In-process register inspection through the signal frame, see
+ * sigframe.h
+ *
+ * Licensed under GPLv2.
+ */
+#include <signal.h>
+
+#include "sigframe.h"
+
+#ifndef MSR_VEC
+#define MSR_VEC		(1UL << 25)
+#endif
+#ifndef MSR_VSX
+#define MSR_VSX		(1UL << 23)
+#endif
+
+/* gp_regs[] of the frame are laid out as struct pt_regs */
+#define SIGFRAME_NIP	(offsetof(struct pt_regs, nip) / sizeof(unsigned long))
+
+bool sigframe_armed;
+
+static struct reg_snapshot *frames;
+static int frames_nr;
+static volatile int hits;
+static struct sigaction old_action;
+
+#ifdef __powerpc__
+/*
+ * The VMX registers are only saved once the thread used them, and the
+ * low doublewords of VSR0-31 follow them, as in the kernel's
+ * setup_sigcontext(). Returns the running SNAP_* flags filled.
+ */
+static unsigned long sigframe_regs(const mcontext_t *mc, struct reg_set *set)
+{
+	unsigned long valid = SNAP_GPR | SNAP_FPR;
+
+	memcpy(&set->gpr, mc->gp_regs, sizeof(set->gpr));
+	memcpy(&set->fpr, mc->fp_regs, sizeof(set->fpr));
+
+	if (mc->v_regs && (set->gpr.msr & MSR_VEC)) {
+		memcpy(&set->vmx, mc->v_regs, sizeof(set->vmx));
+		valid |= SNAP_VMX;
+	}
+	if (mc->v_regs && (set->gpr.msr & MSR_VSX)) {
+		memcpy(&set->vsx, (char *)mc->v_regs + sizeof(set->vmx),
+		       sizeof(set->vsx));
+		valid |= SNAP_VSX;
+	}
+	return valid;
+}
+#endif
+
+/* Only a frame from a transaction has the checkpointed state */
+int sigframe_snapshot(const ucontext_t *uc, struct reg_snapshot *snap)
+{
+	snap->valid = 0;
+#ifdef __powerpc__
+	if (uc->uc_link) {
+		snap->valid |= sigframe_regs(&uc->uc_link->uc_mcontext, &snap->live);
+		snap->valid |= sigframe_regs(&uc->uc_mcontext, &snap->ckpt) << SNAP_CKPT_SHIFT;
+	} else {
+		snap->valid |= sigframe_regs(&uc->uc_mcontext, &snap->live);
+	}
+	return TEST_PASS;
+#else
+	return TEST_FAIL;
+#endif
+}
+
+static void sigframe_handler(int sig, siginfo_t *info, void *ctx)
+{
+	ucontext_t *uc = ctx;
+
+	if (hits < frames_nr)
+		sigframe_snapshot(uc, &frames[hits]);
+	hits++;
+
+#ifdef __powerpc__
+	/* The kernel resumes at the running context's nip: skip the trap */
+	if (uc->uc_link)
+		uc = uc->uc_link;
+	uc->uc_mcontext.gp_regs[SIGFRAME_NIP] += 4;
+#endif
+}
+
+int sigframe_arm(struct reg_snapshot *snaps, int nr)
+{
+	struct sigaction sa = {
+		.sa_sigaction = sigframe_handler,
+		.sa_flags = SA_SIGINFO,
+	};
+
+	frames = snaps;
+	frames_nr = nr;
+	hits = 0;
+
+	if (sigaction(SIGTRAP, &sa, &old_action)) {
+		perror("sigaction");
+		return TEST_FAIL;
+	}
+	sigframe_armed = true;
+	return TEST_PASS;
+}
+
+int sigframe_disarm(void)
+{
+	sigframe_armed = false;
+	if (sigaction(SIGTRAP, &old_action, NULL))
+		perror("sigaction");
+	return hits;
+}
+
+/*
+ * Run cycle() runs times, each of which must stop once at
+ * sigframe_break() and then abort, and call check() on every frame.
+ */
+int sigframe_run(const char *name, tm_cycle_t cycle, int runs,
+		 sigframe_check_t check, void *arg)
+{
+	static struct reg_snapshot snap;
+	unsigned long texasr;
+	int i, stops, aborted;
+	u64 start;
+
+	start = monotonic_ns();
+	for (i = 0; i < runs; i++) {
+		if (sigframe_arm(&snap, 1))
+			return TEST_FAIL;
+		aborted = cycle(&texasr);
+		stops = sigframe_disarm();
+
+		if (stops != 1) {
+			printf("%s: %d stops in run %d\n", name, stops, i);
+			return TEST_FAIL;
+		}
+		if (!aborted) {
+			printf("%s: transaction survived the signal\n", name);
+			return TEST_FAIL;
+		}
+		if (!(snap.valid & SNAP_CGPR)) {
+			printf("%s: signal taken outside the transaction\n", name);
+			return TEST_FAIL;
+		}
+		if (check(&snap, arg))
+			return TEST_FAIL;
+	}
+
+	printf("%s: %d stops in %llu us\n", name, runs,
+	       (monotonic_ns() - start) / 1000);
+	return TEST_PASS;
+}
@@ -0,0 +1,56 @@
+/*
+ * In-process register inspection through the signal frame
+ *
+ * A signal taken in a transaction, suspended or not, gets a frame with
+ * both register files: uc_mcontext holds the checkpointed state and
+ * uc_link's context the transactional, running one. sigframe_break(),
+ * called where a tracer would stop the test, traps into a SIGTRAP
+ * handler that copies them into a struct reg_snapshot laid out as
+ * snapshot_all() fills it, without a tracer and the two context
+ * switches per stop. Like a ptrace stop, the signal dooms the
+ * transaction.
+ *
+ * A trap rather than kill(): the frame then has every register exactly
+ * as at the call, nothing is clobbered on a syscall path through libc.
+ *
+ * Licensed under GPLv2.
+ */
+#ifndef _SIGFRAME_H
+#define _SIGFRAME_H
+
+#include <ucontext.h>
+
+#include "tm_stress.h"
+
+#if defined(__powerpc__)
+#define SIGFRAME_TRAP	"trap"
+#elif defined(__x86_64__)
+#define SIGFRAME_TRAP	"int3"
+#else
+#error "No trap instruction for this architecture"
+#endif
+
+/* Stops each in-process test takes */
+#define SIGFRAME_RUNS	1000
+
+extern bool sigframe_armed;
+
+/* Rendezvous for the test bodies, a no-op unless sigframe_arm() ran */
+static inline void sigframe_break(void)
+{
+	if (sigframe_armed)
+		asm volatile(SIGFRAME_TRAP ::: "memory");
+}
+
+int sigframe_snapshot(const ucontext_t *uc, struct reg_snapshot *snap);
+
+/* Capture the frames of the next nr stops, returns the stops taken */
+int sigframe_arm(struct reg_snapshot *snaps, int nr);
+int sigframe_disarm(void);
+
+typedef int (*sigframe_check_t)(const struct reg_snapshot *snap, void *arg);
+
+int sigframe_run(const char *name, tm_cycle_t cycle, int runs,
+		 sigframe_check_t check, void *arg);
+
+#endif /* _SIGFRAME_H */
@@ -0,0 +1,606 @@
+/*
+ * The gpr, fpr, vsx and tar tests on the software POWER8 model
+ *
+ * Each scenario runs the tm_spd() sequence of its hardware twin. At
+ * break_here the tracer checks the running (suspended) and checkpointed
+ * values through the ptrace.h helpers and rewrites the checkpoint; the
+ * transaction then fails on TRESUME and the tracee must see the new
+ * checkpoint and a TEXASR blaming the reschedule. sim_regcache repeats
+ * the gpr scenarios with the tracer going through a regset cache, and
+ * sim_diff checks the masks of the snapshot diff against known flips.
+ * sim_rendezvous runs the tracer/tracee rendezvous between processes,
+ * sim_core a snapshot through a core file and back.
+ * SIM_ITERATIONS sets the number of scenarios per test.
+ *
+ * Licensed under GPLv2.
+ */
+#include "core.h"
+#include "rendezvous.h"
+#include "sim.h"
+
+#define SIM_ITERATIONS	10000
+
+/* Tracee buffers, laid out for the matching sim_load_*() */
+struct scenario {
+	unsigned long ckpt[128];
+	unsigned long tx[128];
+	unsigned long susp[128];
+	unsigned long ckpt_new[128];	/* written by the tracer */
+	unsigned long out[128];
+};
+
+static unsigned long rand_ul(unsigned int *seed)
+{
+	return ((unsigned long)rand_r(seed) << 33) ^ ((unsigned long)rand_r(seed) << 11) ^
+	       rand_r(seed);
+}
+
+/* A float whose double image is returned in *bits */
+static float rand_float(unsigned int *seed, unsigned long *bits)
+{
+	float f = (float)rand_r(seed) / (1 + rand_r(seed) % 1000);
+	double d = f;
+
+	memcpy(bits, &d, sizeof(d));
+	return f;
+}
+
+static int check(const char *what, const unsigned long *got,
+		 const unsigned long *want, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		if (got[i] != want[i]) {
+			printf("%s[%d]: %lx, expected %lx\n", what, i, got[i], want[i]);
+			return TEST_FAIL;
+		}
+	}
+	return TEST_PASS;
+}
+
+static int check_texasr(pid_t child)
+{
+	struct tm_spr_regs spr;
+
+	if (show_tm_spr(child, &spr))
+		return TEST_FAIL;
+
+	if ((spr.tm_texasr >> 56) != TM_CAUSE_RESCHED ||
+	    !(spr.tm_texasr & TEXASR_FS) || !(spr.tm_texasr & TEXASR_SPD)) {
+		analyse_texasr(spr.tm_texasr);
+		return TEST_FAIL;
+	}
+	return TEST_PASS;
+}
+
+/* GPR: r14-r23 */
+static int tracer_gpr(pid_t child, void *arg)
+{
+	struct scenario *s = arg;
+	unsigned long gpr[18];
+
+	if (start_trace(child))
+		return TEST_FAIL;
+	if (show_gpr(child, gpr) || check("gpr", gpr, s->susp, 10))
+		return TEST_FAIL;
+	if (show_ckpt_gpr(child, gpr) || check("ckpt gpr", gpr, s->ckpt, 10))
+		return TEST_FAIL;
+	if (check_texasr(child))
+		return TEST_FAIL;
+	if (write_ckpt_gpr(child, s->ckpt_new[0]))
+		return TEST_FAIL;
+	return stop_trace(child);
+}
+
+static void fill_gpr(struct scenario *s, unsigned int *seed)
+{
+	int i;
+
+	for (i = 0; i < 10; i++) {
+		s->ckpt[i] = rand_ul(seed);
+		s->tx[i] = rand_ul(seed);
+		s->susp[i] = rand_ul(seed);
+	}
+	s->ckpt_new[0] = rand_ul(seed);
+	for (i = 1; i < 10; i++)
+		s->ckpt_new[i] = s->ckpt_new[0];
+}
+
+/*
+ * GPR again, through a regset cache: the checkpoint write must stay in
+ * the cache until stop_trace() flushes it, then read back uncached.
+ */
+static int tracer_regcache(pid_t child, void *arg)
+{
+	const struct snapshot_regset *r = regset_lookup(SNAP_CGPR);
+	struct scenario *s = arg;
+	struct regset_cache cache;
+	struct reg_snapshot raw;
+	unsigned long gpr[18];
+
+	if (start_trace(child) || regcache_attach(&cache, child))
+		return TEST_FAIL;
+	if (show_gpr(child, gpr) || check("gpr", gpr, s->susp, 10))
+		goto out;
+	if (write_ckpt_gpr(child, s->ckpt_new[0]))
+		goto out;
+	if (show_ckpt_gpr(child, gpr) || check("cached ckpt gpr", gpr, s->ckpt_new, 10))
+		goto out;
+
+	if (regset_xfer(child, r, (char *)&raw + r->offset, false)) {
+		regset_perror(child, r, false);
+		goto out;
+	}
+	if (check("ckpt gpr before flush", &raw.ckpt.gpr.gpr[14], s->ckpt, 10))
+		goto out;
+	if (!(cache.dirty & SNAP_CGPR)) {
+		printf("checkpointed GPRs not dirty\n");
+		goto out;
+	}
+
+	if (stop_trace(child))
+		goto out;
+	if (cache.valid || cache.dirty) {
+		printf("regset cache kept %lx valid, %lx dirty\n", cache.valid, cache.dirty);
+		goto out;
+	}
+	regcache_detach(&cache);
+	if (show_ckpt_gpr(child, gpr) || check("ckpt gpr after flush", gpr, s->ckpt_new, 10))
+		return TEST_FAIL;
+	return TEST_PASS;
+out:
+	regcache_detach(&cache);
+	return TEST_FAIL;
+}
+
+/* FPR: single precision loads, compared as doubles */
+static int tracer_fpr(pid_t child, void *arg)
+{
+	struct scenario *s = arg;
+	unsigned long fpr[32];
+
+	if (start_trace(child))
+		return TEST_FAIL;
+	if (show_fpr(child, fpr) || check("fpr", fpr, &s->susp[64], 32))
+		return TEST_FAIL;
+	if (show_ckpt_fpr(child, fpr) || check("ckpt fpr", fpr, &s->ckpt[64], 32))
+		return TEST_FAIL;
+	if (check_texasr(child))
+		return TEST_FAIL;
+	if (write_ckpt_fpr(child, s->ckpt_new[64]))
+		return TEST_FAIL;
+	return stop_trace(child);
+}
+
+/* The float images go in the first 32 words, their doubles at 64 */
+static void fill_fpr(struct scenario *s, unsigned int *seed)
+{
+	float *ckpt = (float *)s->ckpt, *tx = (float *)s->tx, *susp = (float *)s->susp;
+	float f;
+	int i;
+
+	for (i = 0; i < 32; i++) {
+		ckpt[i] = rand_float(seed, &s->ckpt[64 + i]);
+		tx[i] = rand_float(seed, &s->tx[64 + i]);
+		susp[i] = rand_float(seed, &s->susp[64 + i]);
+	}
+	f = rand_float(seed, &s->ckpt_new[64]);
+	for (i = 0; i < 32; i++) {
+		((float *)s->ckpt_new)[i] = f;
+		s->ckpt_new[64 + i] = s->ckpt_new[64];
+	}
+}
+
+/* VSX: VSR0-63, the VSX regset covering doubleword 1 of VSR0-31 */
+static int tracer_vsx(pid_t child, void *arg)
+{
+	struct scenario *s = arg;
+	unsigned long vsx[32], want[32];
+	unsigned long vmx[34][2];
+	int i;
+
+	if (start_trace(child))
+		return TEST_FAIL;
+
+	if (show_vsx(child, vsx))
+		return TEST_FAIL;
+	for (i = 0; i < 32; i++)
+		want[i] = s->susp[2 * i + 1];
+	if (check("vsx", vsx, want, 32))
+		return TEST_FAIL;
+
+	if (show_vmx(child, vmx) || check("vmx", vmx[0], &s->susp[64], 64))
+		return TEST_FAIL;
+
+	if (show_vsx_ckpt(child, vsx))
+		return TEST_FAIL;
+	for (i = 0; i < 32; i++)
+		want[i] = s->ckpt[2 * i + 1];
+	if (check("ckpt vsx", vsx, want, 32))
+		return TEST_FAIL;
+
+	if (show_vmx_ckpt(child, vmx) || check("ckpt vmx", vmx[0], &s->ckpt[64], 64))
+		return TEST_FAIL;
+	if (check_texasr(child))
+		return TEST_FAIL;
+
+	for (i = 0; i < 32; i++)
+		vsx[i] = s->ckpt_new[2 * i + 1];
+	if (write_vsx_ckpt(child, vsx))
+		return TEST_FAIL;
+	return stop_trace(child);
+}
+
+static void fill_vsx(struct scenario *s, unsigned int *seed)
+{
+	int i;
+
+	for (i = 0; i < 128; i++) {
+		s->ckpt[i] = rand_ul(seed);
+		s->tx[i] = rand_ul(seed);
+		s->susp[i] = rand_ul(seed);
+	}
+	/* Only doubleword 1 of VSR0-31 is rewritten */
+	for (i = 0; i < 128; i++)
+		s->ckpt_new[i] = (i < 64 && (i & 1)) ? rand_ul(seed) : s->ckpt[i];
+}
+
+/* TAR, PPR and DSCR */
+static int tracer_tar(pid_t child, void *arg)
+{
+	struct scenario *s = arg;
+	unsigned long spr[3];
+
+	if (start_trace(child))
+		return TEST_FAIL;
+	if (show_tar_registers(child, spr) || check("tar", spr, s->susp, 3))
+		return TEST_FAIL;
+	if (show_tm_checkpointed_state(child, spr) || check("ckpt tar", spr, s->ckpt, 3))
+		return TEST_FAIL;
+	if (check_texasr(child))
+		return TEST_FAIL;
+	if (write_ckpt_tar_registers(child, s->ckpt_new[0], s->ckpt_new[1], s->ckpt_new[2]))
+		return TEST_FAIL;
+	return stop_trace(child);
+}
+
+static void fill_tar(struct scenario *s, unsigned int *seed)
+{
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		s->ckpt[i] = rand_ul(seed);
+		s->tx[i] = rand_ul(seed);
+		s->susp[i] = rand_ul(seed);
+		s->ckpt_new[i] = rand_ul(seed);
+	}
+}
+
+static int run_scenarios(const char *name, sim_load_t load,
+			 void (*store)(struct sim_cpu *, void *),
+			 void (*fill)(struct scenario *, unsigned int *),
+			 int (*tracer)(pid_t, void *), int words)
+{
+	static struct scenario s;
+	struct sim_cpu cpu;
+	unsigned int seed = 1;
+	int i, iterations = SIM_ITERATIONS;
+	u64 start, ns;
+	char *env;
+
+	env = getenv("SIM_ITERATIONS");
+	if (env)
+		iterations = atoi(env);
+
+	if (sim_cpu_init(&cpu))
+		return TEST_FAIL;
+	cpu.tracer = tracer;
+	cpu.tracer_arg = &s;
+
+	start = monotonic_ns();
+	for (i = 0; i < iterations; i++) {
+		fill(&s, &seed);
+
+		if (!sim_tm_spd(&cpu, load, s.ckpt, s.tx, s.susp)) {
+			printf("%s: transaction committed in iteration %d\n", name, i);
+			return TEST_FAIL;
+		}
+		if (cpu.tracer_status) {
+			printf("%s: tracer failed in iteration %d\n", name, i);
+			return TEST_FAIL;
+		}
+
+		/* The failure handler must find the tracer's checkpoint */
+		store(&cpu, s.out);
+		if (check("after abort", s.out, s.ckpt_new, words))
+			return TEST_FAIL;
+	}
+	ns = monotonic_ns() - start;
+
+	printf("%s: %d scenarios in %llu us (%llu/s)\n", name, iterations,
+	       ns / 1000, ns ? iterations * 1000000000ULL / ns : 0);
+	sim_cpu_fini(&cpu);
+	return TEST_PASS;
+}
+
+static int sim_gpr(void)
+{
+	return run_scenarios("gpr", sim_load_gpr, sim_store_gpr, fill_gpr,
+			     tracer_gpr, 10);
+}
+
+static int sim_regcache(void)
+{
+	return run_scenarios("regcache", sim_load_gpr, sim_store_gpr, fill_gpr,
+			     tracer_regcache, 10);
+}
+
+/* sim_store_fpr() writes floats, the first 16 words hold all 32 */
+static int sim_fpr(void)
+{
+	return run_scenarios("fpr", sim_load_fpr, sim_store_fpr, fill_fpr,
+			     tracer_fpr, 16);
+}
+
+static int sim_vsx(void)
+{
+	return run_scenarios("vsx", sim_load_vsx, sim_store_vsx, fill_vsx,
+			     tracer_vsx, 128);
+}
+
+static int sim_tar(void)
+{
+	return run_scenarios("tar", sim_load_spr, sim_store_spr, fill_tar,
+			     tracer_tar, 3);
+}
+
+/* The SPR a DIFF_SPR_* bit number stands for */
+static unsigned long *diff_spr_slot(struct reg_set *set, int i)
+{
+	unsigned long *slots[DIFF_NR_SPRS] = {
+		&set->gpr.ctr, &set->gpr.link, &set->gpr.xer, &set->gpr.ccr,
+		&set->tar, &set->ppr, &set->dscr,
+	};
+
+	return slots[i];
+}
+
+static int check_mask(const char *what, unsigned long got, unsigned long want)
+{
+	if (got == want)
+		return TEST_PASS;
+	printf("%s mask %lx, expected %lx\n", what, got, want);
+	return TEST_FAIL;
+}
+
+/*
+ * The diff engine: one random slot of every class, VSCR and VRSAVE
+ * included, gets a known bit flipped in the running state and another
+ * in the checkpoint, which the second snapshot does not have the VSX
+ * part of. The masks and XORs must name exactly those.
+ */
+static int sim_diff(void)
+{
+	static struct reg_snapshot a, b;
+	struct reg_diff live, ckpt;
+	unsigned int seed = 1;
+	unsigned long bit, *words = (unsigned long *)&a;
+	int i, g, f, v, w, x, spr, nr, iterations = SIM_ITERATIONS;
+	char *env;
+
+	env = getenv("SIM_ITERATIONS");
+	if (env)
+		iterations = atoi(env);
+
+	for (i = 0; i < iterations; i++) {
+		for (w = 0; w < offsetof(struct reg_snapshot, valid) / sizeof(*words); w++)
+			words[w] = rand_ul(&seed);
+		a.valid = SNAP_REG_SET | SNAP_CKPT;
+		b = a;
+		b.valid &= ~SNAP_CVSX;
+
+		g = rand_r(&seed) % 32;
+		f = rand_r(&seed) % 33;
+		v = rand_r(&seed) % 34;
+		w = rand_r(&seed) % 2;
+		x = rand_r(&seed) % 32;
+		spr = rand_r(&seed) % DIFF_NR_SPRS;
+		bit = 1UL << (rand_r(&seed) % 64);
+
+		b.live.gpr.gpr[g] ^= bit;
+		if (f == 32)
+			b.live.fpr.fpscr ^= bit;
+		else
+			b.live.fpr.fpr[f] ^= bit;
+		b.live.vmx.vr[v][w] ^= bit;
+		b.live.vsx.vsr[x] ^= bit;
+		*diff_spr_slot(&b.live, spr) ^= bit;
+		b.ckpt.gpr.gpr[31 - g] ^= bit;
+		b.ckpt.vsx.vsr[x] ^= bit;
+
+		nr = snapshot_diff(&a, &b, &live, &ckpt);
+		if (nr != 6 || check_mask("gpr", live.gpr, 1UL << g) ||
+		    check_mask("fpr", live.fpr, 1UL << f) ||
+		    check_mask("vmx", live.vmx, 1UL << v) ||
+		    check_mask("vsx", live.vsx, 1UL << x) ||
+		    check_mask("spr", live.spr, 1UL << spr) ||
+		    check_mask("ckpt gpr", ckpt.gpr, 1UL << (31 - g)) ||
+		    check_mask("ckpt vsx", ckpt.vsx, 0)) {
+			printf("sim_diff: %d slots differ in iteration %d\n", nr, i);
+			reg_diff_print("live", &live);
+			reg_diff_print("ckpt", &ckpt);
+			return TEST_FAIL;
+		}
+		if (live.gpr_bits[g] != bit || live.fpr_bits[f] != bit ||
+		    live.vmx_bits[v][w] != bit || live.vmx_bits[v][!w] ||
+		    live.vsx_bits[x] != bit || live.spr_bits[spr] != bit ||
+		    ckpt.gpr_bits[31 - g] != bit) {
+			printf("sim_diff: wrong XOR in iteration %d\n", i);
+			reg_diff_print("live", &live);
+			reg_diff_print("ckpt", &ckpt);
+			return TEST_FAIL;
+		}
+	}
+
+	/* The last one, for the names */
+	reg_diff_print("sim_diff:", &live);
+	return TEST_PASS;
+}
+
+/* Snapshot to core file and back, at the stop in the suspended transaction */
+static int tracer_core(pid_t child, void *arg)
+{
+	static const unsigned long flags[] = { SNAP_EBB, SNAP_PMU };
+	static struct reg_snapshot a, b;
+	const struct snapshot_regset *r;
+	struct reg_diff live, ckpt;
+	struct core_file core;
+	unsigned int seed = 1;
+	const char *path = arg;
+	unsigned long *regs;
+	int i, j, nr;
+
+	/* Neither is in the diff engine, give them values to compare */
+	for (i = 0; i < ARRAY_SIZE(flags); i++) {
+		r = regset_lookup(flags[i]);
+		regs = (unsigned long *)((char *)&a + r->offset);
+		for (j = 0; j < r->size / sizeof(*regs); j++)
+			regs[j] = rand_ul(&seed);
+		if (regset_xfer(child, r, regs, true)) {
+			regset_perror(child, r, true);
+			return TEST_FAIL;
+		}
+	}
+
+	if (snapshot_all(child, &a) || snapshot_write_core(path, &a, child))
+		return TEST_FAIL;
+	if (core_open(path, &core))
+		return TEST_FAIL;
+	if (core_snapshot(&core, &b)) {
+		core_close(&core);
+		return TEST_FAIL;
+	}
+	core_close(&core);
+
+	if (b.valid != a.valid || !(b.valid & SNAP_EBB) || !(b.valid & SNAP_PMU)) {
+		printf("core: regsets %lx, expected %lx\n", b.valid, a.valid);
+		return TEST_FAIL;
+	}
+	nr = snapshot_diff(&a, &b, &live, &ckpt);
+	if (nr) {
+		printf("core: %d registers differ\n", nr);
+		reg_diff_print("core live", &live);
+		reg_diff_print("core ckpt", &ckpt);
+		return TEST_FAIL;
+	}
+	if (check("core ebb", (unsigned long *)&b.ebb, (unsigned long *)&a.ebb,
+		  sizeof(b.ebb) / sizeof(unsigned long)) ||
+	    check("core pmu", (unsigned long *)&b.pmu, (unsigned long *)&a.pmu,
+		  sizeof(b.pmu) / sizeof(unsigned long)) ||
+	    check("core tm_spr", (unsigned long *)&b.tm_spr, (unsigned long *)&a.tm_spr,
+		  sizeof(b.tm_spr) / sizeof(unsigned long)))
+		return TEST_FAIL;
+	return TEST_PASS;
+}
+
+/*
+ * snapshot_write_core(), core_open() and core_snapshot() must give back
+ * every regset of a stop, the EBB and PMU registers included.
+ */
+static int sim_core(void)
+{
+	static struct scenario s;
+	struct sim_cpu cpu;
+	unsigned int seed = 1;
+	char path[64];
+	int ret;
+
+	snprintf(path, sizeof(path), "/tmp/sim_core.%d", getpid());
+	if (sim_cpu_init(&cpu))
+		return TEST_FAIL;
+	cpu.tracer = tracer_core;
+	cpu.tracer_arg = path;
+
+	fill_vsx(&s, &seed);
+	sim_tm_spd(&cpu, sim_load_vsx, s.ckpt, s.tx, s.susp);
+	ret = cpu.tracer_status;
+	if (!ret)
+		printf("core: %s round trip\n", path);
+
+	unlink(path);
+	sim_cpu_fini(&cpu);
+	return ret;
+}
+
+/*
+ * The rendezvous, host side: a child arrives SIM_ITERATIONS times and
+ * must stay parked at each stop until released, so seq never runs
+ * ahead of the stop the parent has seen.
+ */
+static int sim_rendezvous(void)
+{
+	struct rendezvous *r;
+	int i, status, iterations = SIM_ITERATIONS, ret = TEST_FAIL;
+	u32 seen = 0;
+	pid_t pid;
+	char *env;
+
+	env = getenv("SIM_ITERATIONS");
+	if (env)
+		iterations = atoi(env);
+
+	r = rendezvous_create();
+	if (!r)
+		return TEST_FAIL;
+
+	/* The test's stdout is a pipe, nothing buffered may reach the child */
+	fflush(NULL);
+	pid = fork();
+	if (pid == -1) {
+		perror("fork");
+		goto out;
+	}
+	if (pid == 0) {
+		for (i = 0; i < iterations; i++)
+			rendezvous_arrive(r);
+		_exit(0);
+	}
+
+	for (i = 1; i <= iterations; i++) {
+		if (rendezvous_wait(r, &seen, 1000)) {
+			printf("rendezvous: no stop %d\n", i);
+			kill(pid, SIGKILL);
+			break;
+		}
+		if (seen != i || __atomic_load_n(&r->seq, __ATOMIC_ACQUIRE) != i) {
+			printf("rendezvous: stop %u, seq %u, expected %d\n", seen, r->seq, i);
+			kill(pid, SIGKILL);
+			break;
+		}
+		rendezvous_release(r, seen);
+	}
+
+	if (waitpid(pid, &status, 0) == pid && WIFEXITED(status) &&
+	    !WEXITSTATUS(status) && i > iterations)
+		ret = TEST_PASS;
+out:
+	rendezvous_destroy(r);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	struct harness_test tests[] = {
+		{ sim_gpr, "sim_gpr" },
+		{ sim_regcache, "sim_regcache" },
+		{ sim_fpr, "sim_fpr" },
+		{ sim_vsx, "sim_vsx" },
+		{ sim_tar, "sim_tar" },
+		{ sim_diff, "sim_diff" },
+		{ sim_rendezvous, "sim_rendezvous" },
+		{ sim_core, "sim_core" },
+	};
+
+	return test_harness_parallel(tests, ARRAY_SIZE(tests), ARRAY_SIZE(tests));
+}
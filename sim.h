@@ -0,0 +1,122 @@
+/*
+ * Software POWER8 register file for the ptrace.h helpers
+ *
+ * A struct sim_cpu stands in for a traced thread: it owns a fake pid,
+ * the running and checkpointed register sets and the TM SPRs, and is
+ * driven through the same TBEGIN/TSUSPEND/TRESUME/TEND sequences as the
+ * tm_spd() bodies of gpr.c, fpr.c and vsx.c. Once a sim_cpu exists, its
+ * pid works with every show_*() and write_*() helper, regset_xfer(),
+ * the regset cache and snapshot_all(), on any host architecture.
+ *
+ * Licensed under GPLv2.
+ */
+#ifndef _SIM_H
+#define _SIM_H
+
+#include "ptrace.h"
+
+#ifndef MSR_TM
+#define MSR_TM		(1UL << 32)
+#endif
+#ifndef MSR_TS_S
+#define MSR_TS_S	(1UL << 33)
+#endif
+#ifndef MSR_TS_T
+#define MSR_TS_T	(1UL << 34)
+#endif
+#define MSR_TS_MASK	(MSR_TS_T | MSR_TS_S)
+
+/* Failure causes, TEXASR[0:7], as the kernel reports them */
+#ifndef TM_CAUSE_PERSISTENT
+#define TM_CAUSE_PERSISTENT	0x01
+#define TM_CAUSE_RESCHED	0xde
+#define TM_CAUSE_MISC		0xd6
+#endif
+
+/* What a POWER8 running a TM enabled kernel advertises */
+#define SIM_HWCAP	(PPC_FEATURE_HAS_ALTIVEC | PPC_FEATURE_HAS_VSX | \
+			 PPC_FEATURE_ARCH_2_06)
+#define SIM_HWCAP2	(PPC_FEATURE2_ARCH_2_07 | PPC_FEATURE2_HTM | \
+			 PPC_FEATURE2_DSCR | PPC_FEATURE2_EBB | \
+			 PPC_FEATURE2_TAR)
+
+/* Above any pid_max, so never mistaken for a real process */
+#define SIM_PID_BASE	0x7f000000
+#define SIM_MAX		64
+#define SIM_TEXT	0x10000000UL	/* nip after sim_cpu_init() */
+
+enum sim_tm_state {
+	SIM_TM_NONE,
+	SIM_TM_TRANSACTIONAL,
+	SIM_TM_SUSPENDED,
+};
+
+/* Control flow after a sim_*() instruction */
+#define SIM_NEXT	0	/* fall through */
+#define SIM_ABORTED	1	/* rolled back, now at the failure handler */
+
+struct sim_cpu {
+	pid_t pid;
+	struct reg_snapshot regs;	/* live, ckpt, tm_spr, ebb and pmu */
+	enum sim_tm_state state;
+	int depth;			/* TBEGIN nesting, flattened */
+	bool doomed;			/* failure recorded, rollback pending */
+	bool stopped;			/* tracer may access the registers */
+	bool used_ebb;
+
+	/* Run at each sim_break() stop, like a tracer waiting on the pid */
+	int (*tracer)(pid_t child, void *arg);
+	void *tracer_arg;
+	int tracer_status;		/* TEST_FAIL once any stop failed */
+};
+
+/*
+ * The first sim_cpu switches the capabilities over to those of the
+ * simulated POWER8, PPC_CAPS still applying on top.
+ */
+int sim_cpu_init(struct sim_cpu *cpu);
+void sim_cpu_fini(struct sim_cpu *cpu);
+
+/* tbegin. - the return value is the "beq" to the failure handler */
+int sim_tbegin(struct sim_cpu *cpu);
+int sim_tsuspend(struct sim_cpu *cpu);
+/* A failure recorded while suspended takes effect here */
+int sim_tresume(struct sim_cpu *cpu);
+int sim_tend(struct sim_cpu *cpu);
+/* tabort. with a cause code, eg. to model a footprint or conflict abort */
+int sim_tabort(struct sim_cpu *cpu, unsigned char cause);
+
+/*
+ * "bl break_here" under a tracer: the thread stops, which makes the
+ * kernel reclaim (and so doom) an active transaction, the tracer runs,
+ * and the thread continues. Stopped while transactional it rolls back
+ * straight away, while suspended it carries on until TRESUME.
+ */
+int sim_break(struct sim_cpu *cpu);
+
+/*
+ * Loads and stores mirroring ptrace.S. The VSX image is VSR0-63 as
+ * doubleword pairs: VSR0-31 overlay the FPRs (doubleword 0) and the VSX
+ * regset (doubleword 1), VSR32-63 are VR0-31.
+ */
+void sim_load_gpr(struct sim_cpu *cpu, const void *p);
+void sim_store_gpr(struct sim_cpu *cpu, void *p);
+void sim_load_fpr(struct sim_cpu *cpu, const void *p);
+void sim_store_fpr(struct sim_cpu *cpu, void *p);
+void sim_load_vsx(struct sim_cpu *cpu, const void *p);
+void sim_store_vsx(struct sim_cpu *cpu, void *p);
+/* mtspr of TAR, PPR and DSCR, in that order */
+void sim_load_spr(struct sim_cpu *cpu, const void *p);
+void sim_store_spr(struct sim_cpu *cpu, void *p);
+
+typedef void (*sim_load_t)(struct sim_cpu *cpu, const void *p);
+
+/*
+ * The tm_spd() sequence: load ckpt, TBEGIN, load tx, TSUSPEND, load
+ * susp, break_here, TRESUME, TEND. Returns 1 if the transaction failed,
+ * TEXASR then says why, 0 if it committed.
+ */
+int sim_tm_spd(struct sim_cpu *cpu, sim_load_t load, const void *ckpt,
+	       const void *tx, const void *susp);
+
+#endif /* _SIM_H */
@@ -0,0 +1,412 @@
+/*
+ * Software POWER8 register file, see sim.h
+ *
+ * Licensed under GPLv2.
+ */
+#include "sim.h"
+
+static struct sim_cpu *sim_cpus[SIM_MAX];
+static pid_t sim_next_pid = SIM_PID_BASE;
+
+static struct sim_cpu *sim_lookup(pid_t child)
+{
+	int i;
+
+	if (child < SIM_PID_BASE)
+		return NULL;
+
+	for (i = 0; i < SIM_MAX; i++)
+		if (sim_cpus[i] && sim_cpus[i]->pid == child)
+			return sim_cpus[i];
+	return NULL;
+}
+
+static bool sim_owns(pid_t child)
+{
+	return sim_lookup(child) != NULL;
+}
+
+/* Attaching is only bookkeeping, a sim_cpu is stopped in sim_break() */
+static int sim_attach(pid_t child)
+{
+	return TEST_PASS;
+}
+
+static int sim_resume(pid_t child)
+{
+	struct sim_cpu *cpu = sim_lookup(child);
+
+	if (!cpu->stopped) {
+		errno = ESRCH;
+		perror("sim: tracee not stopped");
+		return TEST_FAIL;
+	}
+	return TEST_PASS;
+}
+
+/* Size of the kernel regset, no transfer may go past it */
+static size_t sim_regset_size(const struct snapshot_regset *r)
+{
+	switch (r->note) {
+	case NT_PPC_TAR:
+	case NT_PPC_PPR:
+	case NT_PPC_DSCR:
+	case NT_PPC_TM_CTAR:
+	case NT_PPC_TM_CPPR:
+	case NT_PPC_TM_CDSCR:
+		return 8;
+	case NT_PPC_EBB:
+	case NT_PPC_TM_SPR:
+		return 3 * 8;
+	case NT_PPC_PMU:
+		return 5 * 8;
+	}
+	return r->size;
+}
+
+static long sim_xfer(pid_t child, const struct snapshot_regset *r,
+		     void *buf, bool set)
+{
+	struct sim_cpu *cpu = sim_lookup(child);
+	void *reg = (char *)&cpu->regs + r->offset;
+	unsigned long msr, ckpt_msr;
+
+	if (!cpu->stopped) {
+		errno = ESRCH;
+		return -1;
+	}
+	if (!have_hwcap(r->hwcap) || !have_hwcap2(r->hwcap2)) {
+		errno = ENODEV;
+		return -1;
+	}
+	if ((r->flag & SNAP_CKPT) && cpu->state == SIM_TM_NONE) {
+		errno = ENODATA;
+		return -1;
+	}
+	if (r->size > sim_regset_size(r)) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (r->flag == SNAP_EBB && !set && !cpu->used_ebb) {
+		errno = ENODATA;
+		return -1;
+	}
+
+	if (!set) {
+		memcpy(buf, reg, r->size);
+		return 0;
+	}
+
+	/* Like the kernel, the tracer never gets to change the TM state */
+	msr = cpu->regs.live.gpr.msr;
+	ckpt_msr = cpu->regs.ckpt.gpr.msr;
+	memcpy(reg, buf, r->size);
+	cpu->regs.live.gpr.msr = msr;
+	cpu->regs.ckpt.gpr.msr = ckpt_msr;
+
+	if (r->flag == SNAP_EBB)
+		cpu->used_ebb = true;
+	return 0;
+}
+
+static const struct ptrace_backend sim_backend = {
+	.name	= "sim",
+	.owns	= sim_owns,
+	.attach	= sim_attach,
+	.detach	= sim_resume,
+	.cont	= sim_resume,
+	.xfer	= sim_xfer,
+};
+
+int sim_cpu_init(struct sim_cpu *cpu)
+{
+	static bool registered;
+	int i;
+
+	if (!registered) {
+		if (ptrace_backend_register(&sim_backend))
+			return TEST_FAIL;
+		cpu_caps_set(SIM_HWCAP, SIM_HWCAP2);
+		registered = true;
+	}
+
+	memset(cpu, 0, sizeof(*cpu));
+	cpu->regs.live.gpr.nip = SIM_TEXT;
+	cpu->regs.live.gpr.msr = MSR_TM;
+
+	for (i = 0; i < SIM_MAX; i++) {
+		if (!sim_cpus[i]) {
+			cpu->pid = sim_next_pid++;
+			sim_cpus[i] = cpu;
+			return TEST_PASS;
+		}
+	}
+	printf("Too many simulated cpus\n");
+	return TEST_FAIL;
+}
+
+void sim_cpu_fini(struct sim_cpu *cpu)
+{
+	int i;
+
+	for (i = 0; i < SIM_MAX; i++)
+		if (sim_cpus[i] == cpu)
+			sim_cpus[i] = NULL;
+}
+
+static void sim_step(struct sim_cpu *cpu, int insns)
+{
+	cpu->regs.live.gpr.nip += 4 * insns;
+}
+
+static void sim_set_cr0(struct sim_cpu *cpu, unsigned long cr0)
+{
+	cpu->regs.live.gpr.ccr = (cpu->regs.live.gpr.ccr & 0x0fffffffUL) | (cr0 << 28);
+}
+
+static void sim_set_state(struct sim_cpu *cpu, enum sim_tm_state state)
+{
+	unsigned long *msr = &cpu->regs.live.gpr.msr;
+
+	cpu->state = state;
+	*msr &= ~MSR_TS_MASK;
+	if (state == SIM_TM_TRANSACTIONAL)
+		*msr |= MSR_TS_T;
+	else if (state == SIM_TM_SUSPENDED)
+		*msr |= MSR_TS_S;
+}
+
+/*
+ * Record a transaction failure in TEXASR and TFIAR. Only the first one
+ * counts; the rollback itself waits until the thread is transactional.
+ */
+static void sim_fail(struct sim_cpu *cpu, unsigned long cause, unsigned long flags)
+{
+	struct tm_spr_regs *spr = &cpu->regs.tm_spr;
+
+	if (cpu->doomed)
+		return;
+
+	spr->tm_texasr = (cause << 56) | flags | TEXASR_FS | TEXASR_PR;
+	if (cpu->state == SIM_TM_SUSPENDED)
+		spr->tm_texasr |= TEXASR_SPD;
+	spr->tm_tfiar = cpu->regs.live.gpr.nip;
+	cpu->doomed = true;
+}
+
+/* Restore the checkpoint and branch to the failure handler */
+static int sim_rollback(struct sim_cpu *cpu)
+{
+	unsigned long msr = cpu->regs.live.gpr.msr;
+
+	cpu->regs.live = cpu->regs.ckpt;
+	cpu->regs.live.gpr.msr = msr;
+	cpu->regs.live.gpr.nip = cpu->regs.tm_spr.tm_tfhar;
+	sim_set_state(cpu, SIM_TM_NONE);
+	sim_set_cr0(cpu, 0xa);
+	cpu->depth = 0;
+	cpu->doomed = false;
+	return SIM_ABORTED;
+}
+
+int sim_tbegin(struct sim_cpu *cpu)
+{
+	sim_step(cpu, 1);
+
+	switch (cpu->state) {
+	case SIM_TM_NONE:
+		cpu->regs.ckpt = cpu->regs.live;
+		cpu->regs.tm_spr.tm_tfhar = cpu->regs.live.gpr.nip;
+		cpu->depth = 1;
+		sim_set_state(cpu, SIM_TM_TRANSACTIONAL);
+		sim_set_cr0(cpu, 0);
+		return SIM_NEXT;
+	case SIM_TM_TRANSACTIONAL:
+		/* POWER8 flattens nested transactions */
+		cpu->depth++;
+		sim_set_cr0(cpu, 0x4);
+		return SIM_NEXT;
+	case SIM_TM_SUSPENDED:
+	default:
+		/* A TM Bad Thing on hardware, fail it persistently here */
+		sim_fail(cpu, TM_CAUSE_MISC | TM_CAUSE_PERSISTENT, 0);
+		return SIM_NEXT;
+	}
+}
+
+int sim_tsuspend(struct sim_cpu *cpu)
+{
+	sim_step(cpu, 1);
+	if (cpu->state == SIM_TM_TRANSACTIONAL)
+		sim_set_state(cpu, SIM_TM_SUSPENDED);
+	return SIM_NEXT;
+}
+
+int sim_tresume(struct sim_cpu *cpu)
+{
+	sim_step(cpu, 1);
+	if (cpu->state != SIM_TM_SUSPENDED)
+		return SIM_NEXT;
+
+	sim_set_state(cpu, SIM_TM_TRANSACTIONAL);
+	if (cpu->doomed)
+		return sim_rollback(cpu);
+	return SIM_NEXT;
+}
+
+int sim_tend(struct sim_cpu *cpu)
+{
+	sim_step(cpu, 1);
+
+	switch (cpu->state) {
+	case SIM_TM_TRANSACTIONAL:
+		if (cpu->doomed)
+			return sim_rollback(cpu);
+		sim_set_cr0(cpu, 0x4);
+		if (--cpu->depth == 0)
+			sim_set_state(cpu, SIM_TM_NONE);
+		return SIM_NEXT;
+	case SIM_TM_SUSPENDED:
+		sim_fail(cpu, TM_CAUSE_MISC | TM_CAUSE_PERSISTENT, 0);
+		return SIM_NEXT;
+	case SIM_TM_NONE:
+	default:
+		sim_set_cr0(cpu, 0);
+		return SIM_NEXT;
+	}
+}
+
+int sim_tabort(struct sim_cpu *cpu, unsigned char cause)
+{
+	sim_step(cpu, 1);
+	if (cpu->state == SIM_TM_NONE)
+		return SIM_NEXT;
+
+	sim_fail(cpu, cause, TEXASR_ABT);
+	if (cpu->state == SIM_TM_TRANSACTIONAL)
+		return sim_rollback(cpu);
+	return SIM_NEXT;
+}
+
+int sim_break(struct sim_cpu *cpu)
+{
+	sim_step(cpu, 1);
+	if (cpu->state != SIM_TM_NONE)
+		sim_fail(cpu, TM_CAUSE_RESCHED, 0);
+
+	cpu->stopped = true;
+	if (cpu->tracer && cpu->tracer(cpu->pid, cpu->tracer_arg))
+		cpu->tracer_status = TEST_FAIL;
+	cpu->stopped = false;
+
+	if (cpu->state == SIM_TM_TRANSACTIONAL && cpu->doomed)
+		return sim_rollback(cpu);
+	return SIM_NEXT;
+}
+
+void sim_load_gpr(struct sim_cpu *cpu, const void *p)
+{
+	memcpy(&cpu->regs.live.gpr.gpr[14], p, 10 * sizeof(unsigned long));
+	sim_step(cpu, 10);
+}
+
+void sim_store_gpr(struct sim_cpu *cpu, void *p)
+{
+	memcpy(p, &cpu->regs.live.gpr.gpr[14], 10 * sizeof(unsigned long));
+	sim_step(cpu, 10);
+}
+
+void sim_load_fpr(struct sim_cpu *cpu, const void *p)
+{
+	const float *buf = p;
+	double d;
+	int i;
+
+	for (i = 0; i < 32; i++) {
+		d = buf[i];
+		memcpy(&cpu->regs.live.fpr.fpr[i], &d, sizeof(d));
+	}
+	sim_step(cpu, 32);
+}
+
+void sim_store_fpr(struct sim_cpu *cpu, void *p)
+{
+	float *buf = p;
+	double d;
+	int i;
+
+	for (i = 0; i < 32; i++) {
+		memcpy(&d, &cpu->regs.live.fpr.fpr[i], sizeof(d));
+		buf[i] = d;
+	}
+	sim_step(cpu, 32);
+}
+
+void sim_load_vsx(struct sim_cpu *cpu, const void *p)
+{
+	const unsigned long *buf = p;
+	struct reg_set *live = &cpu->regs.live;
+	int i;
+
+	for (i = 0; i < 32; i++) {
+		live->fpr.fpr[i] = buf[2 * i];
+		live->vsx.vsr[i] = buf[2 * i + 1];
+		live->vmx.vr[i][0] = buf[64 + 2 * i];
+		live->vmx.vr[i][1] = buf[64 + 2 * i + 1];
+	}
+	sim_step(cpu, 128);
+}
+
+void sim_store_vsx(struct sim_cpu *cpu, void *p)
+{
+	unsigned long *buf = p;
+	struct reg_set *live = &cpu->regs.live;
+	int i;
+
+	for (i = 0; i < 32; i++) {
+		buf[2 * i] = live->fpr.fpr[i];
+		buf[2 * i + 1] = live->vsx.vsr[i];
+		buf[64 + 2 * i] = live->vmx.vr[i][0];
+		buf[64 + 2 * i + 1] = live->vmx.vr[i][1];
+	}
+	sim_step(cpu, 128);
+}
+
+void sim_load_spr(struct sim_cpu *cpu, const void *p)
+{
+	const unsigned long *buf = p;
+
+	cpu->regs.live.tar = buf[0];
+	cpu->regs.live.ppr = buf[1];
+	cpu->regs.live.dscr = buf[2];
+	sim_step(cpu, 3);
+}
+
+void sim_store_spr(struct sim_cpu *cpu, void *p)
+{
+	unsigned long *buf = p;
+
+	buf[0] = cpu->regs.live.tar;
+	buf[1] = cpu->regs.live.ppr;
+	buf[2] = cpu->regs.live.dscr;
+	sim_step(cpu, 3);
+}
+
+int sim_tm_spd(struct sim_cpu *cpu, sim_load_t load, const void *ckpt,
+	       const void *tx, const void *susp)
+{
+	load(cpu, ckpt);
+	if (sim_tbegin(cpu))
+		return 1;
+
+	load(cpu, tx);
+	sim_tsuspend(cpu);
+	load(cpu, susp);
+	if (sim_break(cpu))
+		return 1;
+	if (sim_tresume(cpu))
+		return 1;
+	if (sim_tend(cpu))
+		return 1;
+	return 0;
+}
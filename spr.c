@@ -1,16 +1,18 @@
-#include <stdlib.h>
+#include "tracer.h"
 
 #define DSCR1   10
 #define DSCR2   50
+#define DSCR_WRITE	20
+#define PPR_LOW		0x8000000000000UL
+#define PPR_VERY_LOW	0x4000000000000UL
 #define SPRN_DSCR      3
 #define SPRN_PPR       896
 
-__attribute__((used)) void break_here(void)
+__attribute__((used)) void spr_break_here(void)
 {
-	//while(!cptr[1]);
 }
 
-void asm_spr(void)
+static void asm_spr(void)
 {
 	asm __volatile__(
 
@@ -18,13 +20,13 @@ void asm_spr(void)
 		"mtspr %[sprn_dscr], 0;"
 		"or     1,1,1;"         /* PPR (0x8000000000000) */
 
-		"bl break_here;"
+		"bl spr_break_here;"
 
 		"li 0, %[dscr2];"        /* DSCR 50 */
 		"mtspr %[sprn_dscr], 0;"
 		"or     31,31,31;"      /* PPR (0x4000000000000) */
 
-		"bl break_here;"
+		"bl spr_break_here;"
 
 		:
 		: [sprn_dscr] "i" (SPRN_DSCR), [dscr1] "i" (DSCR1), [dscr2] "i" (DSCR2)
@@ -34,11 +36,41 @@ void asm_spr(void)
 	exit(0);
 }
 
-int main(int argc, char *argv[])
+/* DSCR and PPR as set before each call, indexed by hit */
+static const unsigned long expect_dscr[] = { DSCR1, DSCR2 };
+static const unsigned long expect_ppr[] = { PPR_LOW, PPR_VERY_LOW };
+
+static int check_break(pid_t child, int hit, void *arg)
 {
-//	SKIP_IF(!((long)get_auxv_entry(AT_HWCAP2) & PPC_FEATURE2_DSCR));
+	unsigned long spr[3], want[3];
+
+	if (hit >= ARRAY_SIZE(expect_dscr)) {
+		printf("unexpected stop %d\n", hit);
+		return TEST_FAIL;
+	}
 
-	asm_spr();
+	if (show_tar_registers(child, spr))
+		return TEST_FAIL;
+	want[0] = spr[0];
+	want[1] = expect_ppr[hit];
+	want[2] = expect_dscr[hit];
+	if (tracer_expect("tar/ppr/dscr", spr, want, 3))
+		return TEST_FAIL;
 
-	return 0;
+	/* The tracee sets its own DSCR again before the next stop */
+	want[2] = DSCR_WRITE;
+	if (write_tar_registers(child, want[0], want[1], want[2]) ||
+	    show_tar_registers(child, spr) ||
+	    tracer_expect("written tar/ppr/dscr", spr, want, 3))
+		return TEST_FAIL;
+	return TEST_PASS;
 }
+
+static int ptrace_spr(void)
+{
+	SKIP_IF(!cpu_caps.dscr || !cpu_caps.tar);
+
+	return trace_breakpoints("spr", asm_spr, "spr_break_here", check_break, NULL);
+}
+
+TEST_REGISTER(ptrace_spr, "spr");
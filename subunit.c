@@ -0,0 +1,213 @@
+/*
+ * Subunit v2 binary stream encoder
+ *
+ * Licensed under GPLv2.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "utils.h"
+#include "subunit.h"
+
+#define SUBUNIT_SIGNATURE	0xb3
+#define SUBUNIT_VERSION		0x2000
+#define FLAG_TEST_ID		0x0800
+#define FLAG_TIMESTAMP		0x0200
+#define FLAG_TAGS		0x0080
+#define FLAG_FILE_CONTENT	0x0040
+#define FLAG_MIME_TYPE		0x0020
+#define FLAG_EOF		0x0010
+
+/* Packets are limited to 4MiB, stay well below with file content */
+#define SUBUNIT_CHUNK		(1024 * 1024)
+
+static u32 crc_table[256];
+
+static void crc32_init(void)
+{
+	u32 c;
+	int i, j;
+
+	for (i = 0; i < 256; i++) {
+		c = i;
+		for (j = 0; j < 8; j++)
+			c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+		crc_table[i] = c;
+	}
+}
+
+static u32 crc32(const u8 *p, size_t len)
+{
+	u32 c = 0xffffffff;
+
+	if (!crc_table[1])
+		crc32_init();
+
+	while (len--)
+		c = crc_table[(c ^ *p++) & 0xff] ^ (c >> 8);
+	return c ^ 0xffffffff;
+}
+
+static int buf_reserve(struct subunit_buf *b, size_t len)
+{
+	size_t size;
+	u8 *data;
+
+	if (b->len + len <= b->size)
+		return 0;
+
+	size = b->size ? b->size : 4096;
+	while (size < b->len + len)
+		size *= 2;
+
+	data = realloc(b->data, size);
+	if (!data)
+		return -1;
+	b->data = data;
+	b->size = size;
+	return 0;
+}
+
+static void put_be(struct subunit_buf *b, u32 val, int bytes)
+{
+	while (bytes--)
+		b->data[b->len++] = val >> (8 * bytes);
+}
+
+/* 2 bit length prefix, 6 to 30 bit big endian value */
+static int number_len(u32 val)
+{
+	if (val < (1 << 6))
+		return 1;
+	if (val < (1 << 14))
+		return 2;
+	if (val < (1 << 22))
+		return 3;
+	return 4;
+}
+
+static void put_number(struct subunit_buf *b, u32 val)
+{
+	int len = number_len(val);
+
+	put_be(b, val | (u32)(len - 1) << (8 * len - 2), len);
+}
+
+static void put_bytes(struct subunit_buf *b, const void *p, size_t len)
+{
+	memcpy(b->data + b->len, p, len);
+	b->len += len;
+}
+
+static void put_string(struct subunit_buf *b, const char *s)
+{
+	size_t len = strlen(s);
+
+	put_number(b, len);
+	put_bytes(b, s, len);
+}
+
+static size_t string_len(const char *s)
+{
+	return number_len(strlen(s)) + strlen(s);
+}
+
+/* Append one packet; file content may be NULL */
+static int subunit_packet(struct subunit_buf *b, const char *test_id,
+			  int status, char **tags, const char *file_name,
+			  const void *data, size_t len, bool eof)
+{
+	u16 flags = SUBUNIT_VERSION | FLAG_TEST_ID | FLAG_TIMESTAMP | status;
+	size_t body, total, start;
+	struct timespec ts;
+	int i, lenlen, nr_tags = 0;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	body = 4 + number_len(ts.tv_nsec) + string_len(test_id);
+	if (tags) {
+		flags |= FLAG_TAGS;
+		for (nr_tags = 0; tags[nr_tags]; nr_tags++)
+			body += string_len(tags[nr_tags]);
+		body += number_len(nr_tags);
+	}
+	if (file_name) {
+		flags |= FLAG_FILE_CONTENT | FLAG_MIME_TYPE;
+		body += string_len("text/plain;charset=utf8");
+		body += string_len(file_name) + number_len(len) + len;
+	}
+	if (eof)
+		flags |= FLAG_EOF;
+
+	/* signature, flags, length (which counts itself) and CRC */
+	total = 1 + 2 + body + 4;
+	for (lenlen = 1; number_len(total + lenlen) > lenlen; lenlen++)
+		;
+	total += lenlen;
+
+	if (buf_reserve(b, total))
+		return -1;
+
+	start = b->len;
+	b->data[b->len++] = SUBUNIT_SIGNATURE;
+	put_be(b, flags, 2);
+	put_number(b, total);
+	put_be(b, ts.tv_sec, 4);
+	put_number(b, ts.tv_nsec);
+	put_string(b, test_id);
+	if (tags) {
+		put_number(b, nr_tags);
+		for (i = 0; i < nr_tags; i++)
+			put_string(b, tags[i]);
+	}
+	if (file_name) {
+		put_string(b, "text/plain;charset=utf8");
+		put_string(b, file_name);
+		put_number(b, len);
+		put_bytes(b, data, len);
+	}
+	put_be(b, crc32(b->data + start, b->len - start), 4);
+	return 0;
+}
+
+/*
+ * Append a test event to b. Any captured output is attached as a file
+ * named file_name, split over as many packets as needed; the status
+ * and tags go on the last one.
+ */
+int subunit_v2_event(struct subunit_buf *b, const char *test_id, int status,
+		     char **tags, const char *file_name,
+		     const void *data, size_t len)
+{
+	const char *p = data;
+	size_t chunk;
+
+	while (file_name && len > SUBUNIT_CHUNK) {
+		chunk = SUBUNIT_CHUNK;
+		if (subunit_packet(b, test_id, SUBUNIT_INPROGRESS, NULL,
+				   file_name, p, chunk, false))
+			return -1;
+		p += chunk;
+		len -= chunk;
+	}
+
+	return subunit_packet(b, test_id, status, tags, file_name, p, len,
+			      file_name != NULL);
+}
+
+int subunit_buf_append(struct subunit_buf *b, const void *p, size_t len)
+{
+	if (buf_reserve(b, len))
+		return -1;
+	put_bytes(b, p, len);
+	return 0;
+}
+
+void subunit_buf_free(struct subunit_buf *b)
+{
+	free(b->data);
+	memset(b, 0, sizeof(*b));
+}
@@ -6,6 +6,9 @@
 #ifndef _SELFTESTS_POWERPC_SUBUNIT_H
 #define _SELFTESTS_POWERPC_SUBUNIT_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 static inline void test_start(char *name)
 {
 	printf("test: %s\n", name);
@@ -49,4 +52,28 @@ static inline void test_set_git_version(char *value)
 	printf("tags: git_version:%s\n", value);
 }
 
+static inline void test_set_tags(char *tags)
+{
+	printf("tags: %s\n", tags);
+}
+
+/* Subunit v2 binary stream, see subunit.c */
+#define SUBUNIT_EXISTS		1
+#define SUBUNIT_INPROGRESS	2
+#define SUBUNIT_SUCCESS		3
+#define SUBUNIT_SKIP		5
+#define SUBUNIT_FAIL		6
+
+struct subunit_buf {
+	uint8_t *data;
+	size_t len;
+	size_t size;
+};
+
+int subunit_v2_event(struct subunit_buf *b, const char *test_id, int status,
+		     char **tags, const char *file_name,
+		     const void *data, size_t len);
+int subunit_buf_append(struct subunit_buf *b, const void *p, size_t len);
+void subunit_buf_free(struct subunit_buf *b);
+
 #endif /* _SELFTESTS_POWERPC_SUBUNIT_H */
@@ -0,0 +1,112 @@
+/*
+ * TEXASR decoding and abort accounting, see texasr.h
+ *
+ * Licensed under GPLv2.
+ */
+#include "texasr.h"
+
+struct texasr_counters *texasr_counters_list;
+
+void texasr_print(FILE *f, const struct texasr_info *info, enum texasr_format fmt)
+{
+	const char *sep = "";
+	unsigned int i;
+
+	switch (fmt) {
+	case TEXASR_JSON:
+		fprintf(f, "{\"texasr\": \"0x%016lx\", \"code\": %u, \"persistent\": %s, "
+			"\"privilege\": \"%s\", \"suspended\": %s, \"flags\": [",
+			info->texasr, info->code, texasr_persistent(info) ? "true" : "false",
+			texasr_priv_names[info->priv], info->suspended ? "true" : "false");
+		for (i = 0; i < ARRAY_SIZE(texasr_flags); i++) {
+			if (info->flags & TEXASR_FLAG(texasr_flags[i].bit)) {
+				fprintf(f, "%s\"%s\"", sep, texasr_flags[i].name);
+				sep = ", ";
+			}
+		}
+		fprintf(f, "]}");
+		break;
+	case TEXASR_SUBUNIT:
+		fprintf(f, "tags: texasr:0x%lx texasr_code:0x%02x texasr_priv:%s\n",
+			info->texasr, info->code, texasr_priv_names[info->priv]);
+		break;
+	case TEXASR_TEXT:
+	default:
+		fprintf(f, "TEXASR: %16lx\t", info->texasr);
+		for (i = 0; i < ARRAY_SIZE(texasr_flags); i++)
+			if (info->flags & TEXASR_FLAG(texasr_flags[i].bit))
+				fprintf(f, "%s  ", texasr_flags[i].name);
+		break;
+	}
+}
+
+void texasr_counters_print(FILE *f, const char *prefix,
+			   const struct texasr_counters *c, enum texasr_format fmt)
+{
+	const char *sep = "";
+	int i;
+
+	switch (fmt) {
+	case TEXASR_JSON:
+		fprintf(f, "{\"aborts\": %llu, \"persistent\": %llu, \"suspended\": %llu, \"codes\": {",
+			c->events, c->persistent, c->suspended);
+		for (i = 0; i < 256; i++) {
+			if (c->code[i]) {
+				fprintf(f, "%s\"0x%02x\": %llu", sep, i, c->code[i]);
+				sep = ", ";
+			}
+		}
+		fprintf(f, "}, \"flags\": {");
+		sep = "";
+		for (i = 0; i < TEXASR_NR_FLAGS; i++) {
+			if (c->flag[i]) {
+				fprintf(f, "%s\"%s\": %llu", sep, texasr_flag_name(i), c->flag[i]);
+				sep = ", ";
+			}
+		}
+		fprintf(f, "}, \"privilege\": {");
+		sep = "";
+		for (i = 0; i < TEXASR_NR_PRIV; i++) {
+			if (c->priv[i]) {
+				fprintf(f, "%s\"%s\": %llu", sep, texasr_priv_names[i], c->priv[i]);
+				sep = ", ";
+			}
+		}
+		fprintf(f, "}}\n");
+		break;
+	case TEXASR_SUBUNIT:
+		fprintf(f, "tags: tm_aborts:%llu tm_persistent:%llu tm_suspended:%llu",
+			c->events, c->persistent, c->suspended);
+		for (i = 0; i < 256; i++)
+			if (c->code[i])
+				fprintf(f, " tm_code_0x%02x:%llu", i, c->code[i]);
+		fprintf(f, "\n");
+		break;
+	case TEXASR_TEXT:
+	default:
+		fprintf(f, "%s%llu aborts, %llu persistent, %llu transient, %llu suspended\n",
+			prefix, c->events, c->persistent, c->events - c->persistent,
+			c->suspended);
+		for (i = 0; i < 256; i++)
+			if (c->code[i])
+				fprintf(f, "%s  code 0x%02x %-10s %llu\n", prefix, i,
+					i & (TEXASR_FP >> 56) ? "persistent" : "transient",
+					c->code[i]);
+		for (i = 0; i < TEXASR_NR_FLAGS; i++)
+			if (c->flag[i])
+				fprintf(f, "%s  %-10s %llu\n", prefix, texasr_flag_name(i), c->flag[i]);
+		for (i = 0; i < TEXASR_NR_PRIV; i++)
+			if (c->priv[i])
+				fprintf(f, "%s  %-10s %llu\n", prefix, texasr_priv_names[i], c->priv[i]);
+		break;
+	}
+}
+
+void analyse_texasr(unsigned long texasr)
+{
+	struct texasr_info info;
+
+	texasr_decode(texasr, &info);
+	texasr_print(stdout, &info, TEXASR_TEXT);
+	printf("TFIAR :%lx\n", get_tfiar());
+}
@@ -0,0 +1,249 @@
+/*
+ * TEXASR decoding and abort accounting
+ *
+ * texasr_decode() turns a TEXASR value into a struct texasr_info with
+ * a shift and a mask, cheap enough for the hot loop of a stress run.
+ * Each thread counts decoded aborts in its own struct texasr_counters;
+ * readers sum all of them without locks, and the formatters print an
+ * event or a sum as text, JSON or subunit tags.
+ *
+ * Licensed under GPLv2.
+ */
+#ifndef _TEXASR_H
+#define _TEXASR_H
+
+#include <stdio.h>
+#include <string.h>
+
+#include "../reg.h"
+#include "utils.h"
+
+/* TEXASR register bits */
+#define TEXASR_FC	0xFE00000000000000
+#define TEXASR_FP	0x0100000000000000
+#define TEXASR_DA	0x0080000000000000
+#define TEXASR_NO	0x0040000000000000
+#define TEXASR_FO	0x0020000000000000
+#define TEXASR_SIC	0x0010000000000000
+#define TEXASR_NTC	0x0008000000000000
+#define TEXASR_TC	0x0004000000000000
+#define TEXASR_TIC	0x0002000000000000
+#define TEXASR_IC	0x0001000000000000
+#define TEXASR_IFC	0x0000800000000000
+#define TEXASR_ABT	0x0000000100000000
+#define TEXASR_SPD	0x0000000080000000
+#define TEXASR_HV	0x0000000020000000
+#define TEXASR_PR	0x0000000010000000
+#define TEXASR_FS	0x0000000008000000
+#define TEXASR_TE	0x0000000004000000
+#define TEXASR_ROT	0x0000000002000000
+
+/*
+ * Every flag sits between ROT and FP, so shifting by ROT's bit number
+ * packs them into 32 bits: compact bit n is TEXASR bit n + 25.
+ */
+#define TEXASR_FLAGS_SHIFT	25
+#define TEXASR_FLAG(bit)	((u32)((bit) >> TEXASR_FLAGS_SHIFT))
+#define TEXASR_NR_FLAGS		32
+
+static const struct {
+	unsigned long bit;
+	const char *name;
+} texasr_flags[] = {
+	{ TEXASR_FP,	"TEXASR_FP" },
+	{ TEXASR_DA,	"TEXASR_DA" },
+	{ TEXASR_NO,	"TEXASR_NO" },
+	{ TEXASR_FO,	"TEXASR_FO" },
+	{ TEXASR_SIC,	"TEXASR_SIC" },
+	{ TEXASR_NTC,	"TEXASR_NTC" },
+	{ TEXASR_TC,	"TEXASR_TC" },
+	{ TEXASR_TIC,	"TEXASR_TIC" },
+	{ TEXASR_IC,	"TEXASR_IC" },
+	{ TEXASR_IFC,	"TEXASR_IFC" },
+	{ TEXASR_ABT,	"TEXASR_ABT" },
+	{ TEXASR_SPD,	"TEXASR_SPD" },
+	{ TEXASR_HV,	"TEXASR_HV" },
+	{ TEXASR_PR,	"TEXASR_PR" },
+	{ TEXASR_FS,	"TEXASR_FS" },
+	{ TEXASR_TE,	"TEXASR_TE" },
+	{ TEXASR_ROT,	"TEXASR_ROT" },
+};
+
+#define TEXASR_FLAGS_MASK						\
+	(TEXASR_FLAG(TEXASR_FP) | TEXASR_FLAG(TEXASR_DA) |		\
+	 TEXASR_FLAG(TEXASR_NO) | TEXASR_FLAG(TEXASR_FO) |		\
+	 TEXASR_FLAG(TEXASR_SIC) | TEXASR_FLAG(TEXASR_NTC) |		\
+	 TEXASR_FLAG(TEXASR_TC) | TEXASR_FLAG(TEXASR_TIC) |		\
+	 TEXASR_FLAG(TEXASR_IC) | TEXASR_FLAG(TEXASR_IFC) |		\
+	 TEXASR_FLAG(TEXASR_ABT) | TEXASR_FLAG(TEXASR_SPD) |		\
+	 TEXASR_FLAG(TEXASR_HV) | TEXASR_FLAG(TEXASR_PR) |		\
+	 TEXASR_FLAG(TEXASR_FS) | TEXASR_FLAG(TEXASR_TE) |		\
+	 TEXASR_FLAG(TEXASR_ROT))
+
+/* Privilege level the failure was recorded in, from TEXASR[HV,PR] */
+enum texasr_priv {
+	TEXASR_PRIV_KERNEL,		/* HV=0 PR=0 */
+	TEXASR_PRIV_USER,		/* HV=0 PR=1 */
+	TEXASR_PRIV_HV,			/* HV=1 PR=0 */
+	TEXASR_PRIV_HV_USER,		/* HV=1 PR=1, not used on POWER8 */
+	TEXASR_NR_PRIV,
+};
+
+static const char * const texasr_priv_names[TEXASR_NR_PRIV] = {
+	"kernel", "user", "hypervisor", "hv-user"
+};
+
+struct texasr_info {
+	unsigned long texasr;
+	u8 code;			/* TEXASR[0:7], FP is the low bit */
+	u8 priv;			/* enum texasr_priv */
+	bool suspended;			/* failure recorded in suspended state */
+	u32 flags;			/* TEXASR_FLAG() bits */
+};
+
+static inline void texasr_decode(unsigned long texasr, struct texasr_info *info)
+{
+	info->texasr = texasr;
+	info->code = texasr >> 56;
+	info->flags = (texasr >> TEXASR_FLAGS_SHIFT) & TEXASR_FLAGS_MASK;
+	info->priv = (texasr & (TEXASR_HV | TEXASR_PR)) >> 28;
+	info->suspended = !!(texasr & TEXASR_SPD);
+}
+
+static inline bool texasr_persistent(const struct texasr_info *info)
+{
+	return info->flags & TEXASR_FLAG(TEXASR_FP);
+}
+
+/*
+ * Abort counters, written by their owner thread only. Updates are
+ * relaxed atomic stores so a reader summing them mid run never sees a
+ * torn value; nothing else is needed as each counter has one writer.
+ */
+struct texasr_counters {
+	u64 events;
+	u64 persistent;
+	u64 suspended;
+	u64 code[256];
+	u64 flag[TEXASR_NR_FLAGS];
+	u64 priv[TEXASR_NR_PRIV];
+	struct texasr_counters *next;	/* on texasr_counters_list */
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+extern struct texasr_counters *texasr_counters_list;
+
+#define texasr_inc(c)	__atomic_store_n(&(c), (c) + 1, __ATOMIC_RELAXED)
+
+static inline void texasr_count(struct texasr_counters *c,
+				const struct texasr_info *info)
+{
+	u32 flags = info->flags;
+
+	texasr_inc(c->events);
+	texasr_inc(c->code[info->code]);
+	texasr_inc(c->priv[info->priv]);
+	if (info->suspended)
+		texasr_inc(c->suspended);
+	if (texasr_persistent(info))
+		texasr_inc(c->persistent);
+
+	while (flags) {
+		texasr_inc(c->flag[__builtin_ctz(flags)]);
+		flags &= flags - 1;
+	}
+}
+
+/* Make a thread's counters visible to texasr_counters_sum() */
+static inline void texasr_counters_register(struct texasr_counters *c)
+{
+	c->next = __atomic_load_n(&texasr_counters_list, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&texasr_counters_list, &c->next, c,
+					    true, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		;
+}
+
+/* Forget every registered thread, once none of them counts any more */
+static inline void texasr_counters_reset(void)
+{
+	__atomic_store_n(&texasr_counters_list, NULL, __ATOMIC_RELEASE);
+}
+
+static inline void texasr_counters_add(struct texasr_counters *sum,
+				       const struct texasr_counters *c)
+{
+	int i;
+
+#define texasr_add(f)	(sum->f += __atomic_load_n(&c->f, __ATOMIC_RELAXED))
+	texasr_add(events);
+	texasr_add(persistent);
+	texasr_add(suspended);
+	for (i = 0; i < 256; i++)
+		texasr_add(code[i]);
+	for (i = 0; i < TEXASR_NR_FLAGS; i++)
+		texasr_add(flag[i]);
+	for (i = 0; i < TEXASR_NR_PRIV; i++)
+		texasr_add(priv[i]);
+#undef texasr_add
+}
+
+/* Totals over every registered thread, safe while they still count */
+static inline void texasr_counters_sum(struct texasr_counters *sum)
+{
+	struct texasr_counters *c;
+
+	memset(sum, 0, sizeof(*sum));
+	for (c = __atomic_load_n(&texasr_counters_list, __ATOMIC_ACQUIRE); c; c = c->next)
+		texasr_counters_add(sum, c);
+}
+
+/* Formatters */
+enum texasr_format {
+	TEXASR_TEXT,
+	TEXASR_JSON,
+	TEXASR_SUBUNIT,		/* a subunit tags: line */
+};
+
+static inline const char *texasr_flag_name(int n)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(texasr_flags); i++)
+		if (TEXASR_FLAG(texasr_flags[i].bit) == 1U << n)
+			return texasr_flags[i].name;
+	return "?";
+}
+
+/* One event, eg. "TEXASR: de000000a8000000\tTEXASR_SPD  TEXASR_PR  ..." */
+void texasr_print(FILE *f, const struct texasr_info *info, enum texasr_format fmt);
+
+/* Aggregated counters, prefix starts each text line */
+void texasr_counters_print(FILE *f, const char *prefix,
+			   const struct texasr_counters *c, enum texasr_format fmt);
+
+static inline int texasr_format_parse(const char *name, enum texasr_format *fmt)
+{
+	if (!strcmp(name, "text"))
+		*fmt = TEXASR_TEXT;
+	else if (!strcmp(name, "json"))
+		*fmt = TEXASR_JSON;
+	else if (!strcmp(name, "subunit"))
+		*fmt = TEXASR_SUBUNIT;
+	else
+		return -1;
+	return 0;
+}
+
+/* Analyse TEXASR after TM failure */
+static inline unsigned long get_tfiar(void)
+{
+	unsigned long ret = 0;
+
+#ifdef __powerpc__
+	asm volatile("mfspr %0,%1" : "=r" (ret): "i" (SPRN_TFIAR));
+#endif
+	return ret;
+}
+
+void analyse_texasr(unsigned long texasr);
+
+#endif /* _TEXASR_H */
@@ -0,0 +1,308 @@
+/*
+ * TM footprint capacity probe
+ *
+ * Grows the read set, then separately the write set, of a transaction
+ * one access at a time and runs each size many times, counting the
+ * commits, the footprint overflows (TEXASR_FO) and the timebase ticks a
+ * transaction takes. The curve is measured per core and per SMT mode:
+ * with k threads of a core running the probe at once, each on a
+ * footprint of its own, in step at every size.
+ *
+ *   TM_CAPACITY_STRIDE	bytes between accesses, CACHE_LINE_SIZE by default
+ *   TM_CAPACITY_ALIGN	offset of the first access into its line, 0
+ *   TM_CAPACITY_LINES	largest number of accesses, 128
+ *
+ * By default only the first core is probed, with CAPACITY_RUNS
+ * transactions per size. -n sets the transactions per size and probes
+ * every core, -t above 1 caps the SMT mode.
+ *
+ * Licensed under GPLv2.
+ */
+#define _GNU_SOURCE	/* For CPU_ZERO etc. */
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "tm_stress.h"
+
+#define CAPACITY_RUNS		200
+#define CAPACITY_LINES		128
+#define CAPACITY_SMT_MAX	8
+
+enum { CAPACITY_READ, CAPACITY_WRITE, CAPACITY_SETS };
+
+static const char * const capacity_sets[CAPACITY_SETS] = { "read", "write" };
+
+struct capacity_opts {
+	unsigned long stride;
+	unsigned long align;
+	int lines;
+	unsigned long runs;
+};
+
+struct capacity_point {
+	u64 commits;
+	u64 overflows;
+	u64 tb;
+};
+
+/* One per probing thread, results indexed [set * lines + accesses - 1] */
+struct capacity_thread {
+	const struct capacity_opts *opts;
+	pthread_mutex_t *start;		/* held while the threads are created */
+	const bool *aborted;		/* set if not all of them could be */
+	pthread_barrier_t *barrier;
+	int cpu;
+	char *buf;
+	struct capacity_point *points;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+/* n > 0 accesses stride bytes apart from p, non zero if the transaction failed */
+#define CAPACITY_KERNEL(fn, access)					\
+static int fn(char *p, unsigned long n, unsigned long stride,		\
+	      unsigned long *texasr)					\
+{									\
+	unsigned long abort, tmp;					\
+									\
+	asm __volatile__(						\
+		"mtctr %[n];"						\
+		TBEGIN							\
+		"beq 2f;"						\
+									\
+		"1: ;"							\
+		access							\
+		"add %[p], %[p], %[stride];"				\
+		"bdnz 1b;"						\
+									\
+		TEND							\
+		"li %[abrt], 0;"					\
+		"b 3f;"							\
+									\
+		"2: ;"							\
+		"li %[abrt], 1;"					\
+		"mfspr %[texasr], %[sprn_texasr];"			\
+									\
+		"3: ;"							\
+		: [abrt] "=&r" (abort), [texasr] "=&r" (*texasr),	\
+		  [tmp] "=&r" (tmp), [p] "+&r" (p)			\
+		: [n] "r" (n), [stride] "r" (stride),			\
+		  [sprn_texasr] "i" (SPRN_TEXASR)			\
+		: "memory", "ctr", "cr0"				\
+		);							\
+									\
+	return abort;							\
+}
+
+CAPACITY_KERNEL(capacity_read, "ld %[tmp], 0(%[p]);")
+CAPACITY_KERNEL(capacity_write, "std %[p], 0(%[p]);")
+
+static void *capacity_probe(void *arg)
+{
+	struct capacity_thread *th = arg;
+	const struct capacity_opts *opts = th->opts;
+	struct capacity_point *pt;
+	unsigned long i, texasr;
+	int set, n, failed;
+	char *p = th->buf + opts->align;
+	cpu_set_t mask;
+	u64 start;
+
+	/* The barrier only opens once every thread is up */
+	pthread_mutex_lock(th->start);
+	pthread_mutex_unlock(th->start);
+	if (*th->aborted)
+		return NULL;
+
+	CPU_ZERO(&mask);
+	CPU_SET(th->cpu, &mask);
+	if (sched_setaffinity(0, sizeof(mask), &mask))
+		perror("sched_setaffinity");
+
+	for (set = 0; set < CAPACITY_SETS; set++) {
+		for (n = 1; n <= opts->lines; n++) {
+			pt = &th->points[set * opts->lines + n - 1];
+			pthread_barrier_wait(th->barrier);
+
+			start = tm_stress_tb();
+			for (i = 0; i < opts->runs; i++) {
+				if (set == CAPACITY_READ)
+					failed = capacity_read(p, n, opts->stride, &texasr);
+				else
+					failed = capacity_write(p, n, opts->stride, &texasr);
+				if (!failed)
+					pt->commits++;
+				else if (texasr & TEXASR_FO)
+					pt->overflows++;
+			}
+			pt->tb += tm_stress_tb() - start;
+		}
+	}
+	return NULL;
+}
+
+/* Cache lines n accesses touch */
+static unsigned long capacity_span(const struct capacity_opts *opts, int n)
+{
+	unsigned long last = opts->align + (n - 1) * opts->stride;
+
+	return last / CACHE_LINE_SIZE - opts->align / CACHE_LINE_SIZE + 1;
+}
+
+/*
+ * The curve of one SMT mode, summed over its threads, and the largest
+ * footprint that still commits at least half the time.
+ */
+static void capacity_report(const struct capacity_opts *opts, int core, int smt,
+			    struct capacity_thread *threads)
+{
+	struct capacity_point sum, *pt;
+	int set, n, t, capacity;
+	u64 total;
+
+	for (set = 0; set < CAPACITY_SETS; set++) {
+		capacity = 0;
+		for (n = 1; n <= opts->lines; n++) {
+			memset(&sum, 0, sizeof(sum));
+			for (t = 0; t < smt; t++) {
+				pt = &threads[t].points[set * opts->lines + n - 1];
+				sum.commits += pt->commits;
+				sum.overflows += pt->overflows;
+				sum.tb += pt->tb;
+			}
+			total = smt * opts->runs;
+			if (sum.commits * 2 >= total && capacity == n - 1)
+				capacity = n;
+
+			printf("tm_capacity: core %d smt %d %s %3d accesses %3lu lines: "
+			       "%6.2f%% commit %6.2f%% overflow %.1f tb ticks/tx\n",
+			       core, smt, capacity_sets[set], n, capacity_span(opts, n),
+			       100.0 * sum.commits / total, 100.0 * sum.overflows / total,
+			       (double)sum.tb / total);
+		}
+		printf("tm_capacity: core %d smt %d %s capacity %d accesses, %lu lines\n",
+		       core, smt, capacity_sets[set], capacity,
+		       capacity ? capacity_span(opts, capacity) : 0);
+	}
+}
+
+/* Run smt threads on the first smt cpus of a core, all in step */
+static int capacity_mode(const struct capacity_opts *opts, int core,
+			 const int *cpus, int smt)
+{
+	struct capacity_thread threads[CAPACITY_SMT_MAX];
+	pthread_t tids[CAPACITY_SMT_MAX];
+	pthread_mutex_t start = PTHREAD_MUTEX_INITIALIZER;
+	pthread_barrier_t barrier;
+	bool aborted = false;
+	size_t len, points;
+	int i, started, ret = TEST_PASS;
+
+	len = opts->align + opts->lines * opts->stride + CACHE_LINE_SIZE;
+	len = (len + CACHE_LINE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1UL);
+	points = CAPACITY_SETS * opts->lines;
+
+	memset(threads, 0, sizeof(threads));
+	for (i = 0; i < smt; i++) {
+		threads[i].opts = opts;
+		threads[i].start = &start;
+		threads[i].aborted = &aborted;
+		threads[i].barrier = &barrier;
+		threads[i].cpu = cpus[i];
+		threads[i].buf = aligned_alloc(CACHE_LINE_SIZE, len);
+		threads[i].points = calloc(points, sizeof(*threads[i].points));
+		if (!threads[i].buf || !threads[i].points) {
+			perror("malloc");
+			ret = TEST_FAIL;
+			goto out;
+		}
+		/* A page fault in the transaction would abort it */
+		memset(threads[i].buf, 0, len);
+	}
+
+	pthread_barrier_init(&barrier, NULL, smt);
+	pthread_mutex_lock(&start);
+	for (started = 0; started < smt; started++) {
+		errno = pthread_create(&tids[started], NULL, capacity_probe, &threads[started]);
+		if (errno) {
+			perror("pthread_create");
+			aborted = true;
+			ret = TEST_FAIL;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&start);
+	for (i = 0; i < started; i++)
+		pthread_join(tids[i], NULL);
+	pthread_barrier_destroy(&barrier);
+
+	if (!aborted)
+		capacity_report(opts, core, smt, threads);
+out:
+	for (i = 0; i < smt; i++) {
+		free(threads[i].buf);
+		free(threads[i].points);
+	}
+	return ret;
+}
+
+static unsigned long capacity_env(const char *name, unsigned long def)
+{
+	char *env = getenv(name);
+
+	return env ? strtoul(env, NULL, 0) : def;
+}
+
+/* Every SMT mode of the first core, or of every core */
+static int capacity(unsigned long runs, bool all_cores, int smt_max)
+{
+	struct capacity_opts opts;
+	struct cpu_pool pool;
+	cpu_set_t probed;		/* cores, by primary thread */
+	int cpus[CAPACITY_SMT_MAX];
+	int i, j, nr, smt, ret = TEST_PASS;
+
+	SKIP_IF(!cpu_caps.htm);
+
+	opts.stride = capacity_env("TM_CAPACITY_STRIDE", CACHE_LINE_SIZE);
+	opts.align = capacity_env("TM_CAPACITY_ALIGN", 0);
+	opts.lines = capacity_env("TM_CAPACITY_LINES", CAPACITY_LINES);
+	opts.runs = runs;
+	if (!opts.stride || opts.stride % 8 || opts.align % 8 || opts.lines < 1) {
+		printf("tm_capacity: stride and alignment must be multiples of 8\n");
+		return TEST_FAIL;
+	}
+
+	if (cpu_pool_init(&pool))
+		return TEST_FAIL;
+
+	CPU_ZERO(&probed);
+	for (i = 0; i < pool.nr; i++) {
+		/* Once per core, at its first CPU in the pool */
+		if (CPU_ISSET(pool.cpus[i].core, &probed))
+			continue;
+		CPU_SET(pool.cpus[i].core, &probed);
+		for (nr = 0, j = i; j < pool.nr && nr < CAPACITY_SMT_MAX; j++)
+			if (pool.cpus[j].core == pool.cpus[i].core)
+				cpus[nr++] = pool.cpus[j].cpu;
+
+		for (smt = 1; smt <= nr && smt <= smt_max; smt *= 2)
+			ret |= capacity_mode(&opts, pool.cpus[i].core, cpus, smt);
+		if (!all_cores)
+			break;
+	}
+
+	cpu_pool_fini(&pool);
+	return ret;
+}
+
+static int capacity_default(void)
+{
+	return capacity(CAPACITY_RUNS, false, CAPACITY_SMT_MAX);
+}
+
+static int capacity_stress(struct tm_stress_opts *opts)
+{
+	return capacity(opts->cycles, true, opts->threads > 1 ? opts->threads : CAPACITY_SMT_MAX);
+}
+
+TEST_REGISTER_STRESS(capacity_default, "tm_capacity", capacity_stress);
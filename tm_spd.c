@@ -0,0 +1,261 @@
+/*
+ * Generic TM suspend/resume test kernel, see tm_spd.h
+ *
+ * spd_sweep runs the kernel of every class for a growing number of
+ * loaded registers, without a tracer, and reports the timebase ticks a
+ * transaction takes and how many aborted. -n and -t run each point
+ * through the stress mode instead. TM_SPD_FILL=index|const|random picks
+ * the values, random by default.
+ *
+ * Licensed under GPLv2.
+ */
+#include "tm_spd.h"
+#include "sigframe.h"
+
+#define TM_SPD_SWEEP_CYCLES	10000	/* per point */
+#define TM_SPD_SWEEP_SEED	0x5eed
+
+extern void load_gpr_n(void *p, int n);
+extern void load_fpr_n(void *p, int n);
+extern void loadvsx_n(void *p, int n);
+
+static struct tm_spd *tm_spd_cur;
+
+static void tm_spd_load_regs(void *buf)
+{
+	switch (tm_spd_cur->class) {
+	case TM_SPD_GPR:
+		load_gpr_n(buf, tm_spd_cur->nr);
+		break;
+	case TM_SPD_FPR:
+		load_fpr_n(buf, tm_spd_cur->nr);
+		break;
+	default:
+		loadvsx_n(buf, tm_spd_cur->nr);
+	}
+}
+
+__attribute__((used)) void tm_spd_load(void)
+{
+	tm_spd_load_regs(tm_spd_cur->load);
+}
+
+__attribute__((used)) void tm_spd_load_new(void)
+{
+	tm_spd_load_regs(tm_spd_cur->load_new);
+}
+
+__attribute__((used)) void tm_spd_load_ckpt(void)
+{
+	tm_spd_load_regs(tm_spd_cur->load_ckpt);
+}
+
+__attribute__((used)) void tm_spd_break_here(void)
+{
+	sigframe_break();
+}
+
+/* One pass of the cycle, non zero if the transaction failed */
+#define TM_SPD_CYCLE(fn, ...)						\
+static int fn(unsigned long *texasr)					\
+{									\
+	unsigned long abort;						\
+									\
+	asm __volatile__(						\
+		"bl tm_spd_load_ckpt;"					\
+									\
+		TBEGIN							\
+		"beq 1f;"						\
+									\
+		"bl tm_spd_load_new;"					\
+		TSUSPEND						\
+		"bl tm_spd_load;"					\
+		"bl tm_spd_break_here;"					\
+		TRESUME							\
+									\
+		TEND							\
+		"li %[abrt], 0;"					\
+		"b 2f;"							\
+									\
+		"1: ;"							\
+		"li %[abrt], 1;"					\
+		"mfspr %[texasr], %[sprn_texasr];"			\
+									\
+		"2: ;"							\
+		: [abrt] "=r" (abort), [texasr] "=r" (*texasr)		\
+		: [sprn_texasr] "i" (SPRN_TEXASR)			\
+		: "memory", TM_CALL_CLOBBERS, __VA_ARGS__		\
+		);							\
+									\
+	return abort;							\
+}
+
+TM_SPD_CYCLE(tm_spd_gpr_once,
+	     "r14", "r15", "r16", "r17", "r18", "r19", "r20", "r21", "r22", "r23")
+TM_SPD_CYCLE(tm_spd_fpr_once, TM_FPR_CLOBBERS)
+TM_SPD_CYCLE(tm_spd_vsx_once, TM_FPR_CLOBBERS, TM_VMX_CLOBBERS)
+
+static const struct {
+	const char *name;
+	tm_cycle_t cycle;
+	int step;			/* of the sweep */
+} tm_spd_classes[TM_SPD_CLASSES] = {
+	[TM_SPD_GPR] = { "gpr", tm_spd_gpr_once, 1 },
+	[TM_SPD_FPR] = { "fpr", tm_spd_fpr_once, 4 },
+	[TM_SPD_VSX] = { "vsx", tm_spd_vsx_once, 8 },
+};
+
+const char *tm_spd_class_name(enum tm_spd_class class)
+{
+	return tm_spd_classes[class].name;
+}
+
+int tm_spd_fill_parse(const char *name, enum tm_spd_fill *fill)
+{
+	if (!strcmp(name, "index"))
+		*fill = TM_SPD_FILL_INDEX;
+	else if (!strcmp(name, "const"))
+		*fill = TM_SPD_FILL_CONST;
+	else if (!strcmp(name, "random"))
+		*fill = TM_SPD_FILL_RANDOM;
+	else
+		return -1;
+	return 0;
+}
+
+static unsigned long tm_spd_word(enum tm_spd_fill fill, int k, int i,
+				 unsigned long *state)
+{
+	switch (fill) {
+	case TM_SPD_FILL_INDEX:
+		return k * (1 + i);
+	case TM_SPD_FILL_CONST:
+		return k;
+	default:
+		return xorshift64(state);
+	}
+}
+
+static float tm_spd_single(enum tm_spd_fill fill, int k, int i,
+			   unsigned long *state)
+{
+	if (fill != TM_SPD_FILL_RANDOM)
+		return tm_spd_word(fill, k, i, state) / 10.0;
+	return random_finite_single(state);
+}
+
+/* The whole of each buffer, whatever nr is */
+void tm_spd_fill(struct tm_spd *spd, enum tm_spd_fill fill, unsigned long seed)
+{
+	void *bufs[] = { spd->load, spd->load_new, spd->load_ckpt };
+	unsigned long state = seed | 1;
+	unsigned long *words;
+	float *singles;
+	int i, k;
+
+	for (k = 1; k <= 3; k++) {
+		words = bufs[k - 1];
+		singles = bufs[k - 1];
+
+		switch (spd->class) {
+		case TM_SPD_GPR:
+			for (i = 0; i < TM_SPD_NGPR; i++)
+				words[i] = tm_spd_word(fill, k, i, &state);
+			break;
+		case TM_SPD_FPR:
+			for (i = 0; i < TM_SPD_NFPR; i++)
+				singles[i] = tm_spd_single(fill, k, i, &state);
+			break;
+		default:
+			for (i = 0; i < 2 * TM_SPD_NVSX; i++)
+				words[i] = tm_spd_word(fill, k, i, &state);
+		}
+	}
+}
+
+tm_cycle_t tm_spd_select(struct tm_spd *spd)
+{
+	tm_spd_cur = spd;
+	return tm_spd_classes[spd->class].cycle;
+}
+
+void tm_spd_tracee(void)
+{
+	unsigned long texasr;
+
+	if (!tm_spd_classes[tm_spd_cur->class].cycle(&texasr)) {
+		printf("transaction survived the tracer\n");
+		exit(1);
+	}
+	exit(0);
+}
+
+/* Big enough for any class */
+static unsigned long sweep_load[2 * TM_SPD_NVSX];
+static unsigned long sweep_load_new[2 * TM_SPD_NVSX];
+static unsigned long sweep_load_ckpt[2 * TM_SPD_NVSX];
+
+static int sweep_point(struct tm_spd *spd, tm_cycle_t cycle)
+{
+	unsigned long i, texasr, aborts = 0;
+	u64 start;
+
+	start = tm_stress_tb();
+	for (i = 0; i < TM_SPD_SWEEP_CYCLES; i++)
+		aborts += !!cycle(&texasr);
+
+	printf("spd_sweep: %s %2d regs: %.1f tb ticks/tx, %.2f%% aborted\n",
+	       tm_spd_class_name(spd->class), spd->nr,
+	       (double)(tm_stress_tb() - start) / TM_SPD_SWEEP_CYCLES,
+	       100.0 * aborts / TM_SPD_SWEEP_CYCLES);
+	return TEST_PASS;
+}
+
+/* Every class from 0 registers up, the stress mode at each point if opts */
+static int spd_sweep(struct tm_stress_opts *opts)
+{
+	struct tm_spd spd;
+	enum tm_spd_fill fill = TM_SPD_FILL_RANDOM;
+	enum tm_spd_class class;
+	tm_cycle_t cycle;
+	char name[32], *env;
+	int ret = TEST_PASS;
+
+	SKIP_IF(!cpu_caps.htm);
+
+	env = getenv("TM_SPD_FILL");
+	if (env && tm_spd_fill_parse(env, &fill)) {
+		printf("TM_SPD_FILL: index, const or random\n");
+		return TEST_FAIL;
+	}
+
+	for (class = 0; class < TM_SPD_CLASSES; class++) {
+		if (class == TM_SPD_VSX && !cpu_caps.vsx) {
+			printf("spd_sweep: no VSX, skipping vsx\n");
+			continue;
+		}
+		spd = (struct tm_spd)TM_SPD(class, sweep_load, sweep_load_new,
+					    sweep_load_ckpt);
+		tm_spd_fill(&spd, fill, TM_SPD_SWEEP_SEED);
+
+		for (spd.nr = 0; spd.nr <= tm_spd_max(class);
+		     spd.nr += tm_spd_classes[class].step) {
+			cycle = tm_spd_select(&spd);
+			if (!opts) {
+				ret |= sweep_point(&spd, cycle);
+				continue;
+			}
+			snprintf(name, sizeof(name), "spd_sweep %s %d",
+				 tm_spd_class_name(class), spd.nr);
+			ret |= tm_stress(name, cycle, opts);
+		}
+	}
+	return ret;
+}
+
+static int spd_sweep_default(void)
+{
+	return spd_sweep(NULL);
+}
+
+TEST_REGISTER_STRESS(spd_sweep_default, "spd_sweep", spd_sweep);
@@ -0,0 +1,68 @@
+/*
+ * Generic TM suspend/resume test kernel
+ *
+ * The cycle the register tests run: load the checkpointed values,
+ * TBEGIN, load the transactional ones, TSUSPEND, load the suspended
+ * ones, stop at tm_spd_break_here(), TRESUME and TEND. A struct tm_spd
+ * picks the register class, how many registers of it are loaded (the
+ * first nr, through the load_*_n() helpers of ptrace.S) and the three
+ * buffers, which tm_spd_fill() fills with a pattern.
+ *
+ * There is one kernel per class, generated from the same asm body with
+ * the clobbers of the class, so that a sweep over nr only changes the
+ * loads.
+ *
+ * Licensed under GPLv2.
+ */
+#ifndef _TM_SPD_H
+#define _TM_SPD_H
+
+#include "tm_stress.h"
+
+/* Registers of a class the kernel can load */
+#define TM_SPD_NGPR	10	/* r14-r23 */
+#define TM_SPD_NFPR	32	/* f0-f31 */
+#define TM_SPD_NVSX	64	/* vs0-vs63 */
+
+enum tm_spd_class {
+	TM_SPD_GPR,		/* unsigned long buf[10] */
+	TM_SPD_FPR,		/* float buf[32] */
+	TM_SPD_VSX,		/* unsigned long buf[128] */
+	TM_SPD_CLASSES,
+};
+
+enum tm_spd_fill {
+	TM_SPD_FILL_INDEX,	/* k * (1 + i), k / 10 for the FPRs */
+	TM_SPD_FILL_CONST,	/* k, k / 10 for the FPRs */
+	TM_SPD_FILL_RANDOM,	/* seeded, finite singles for the FPRs */
+};
+
+struct tm_spd {
+	enum tm_spd_class class;
+	int nr;			/* loaded, from the first of the class */
+	void *load;		/* suspended, k = 1 */
+	void *load_new;		/* transactional, k = 2 */
+	void *load_ckpt;	/* checkpointed, k = 3 */
+};
+
+/* Every register of the class */
+#define TM_SPD(cls, ld, ld_new, ld_ckpt)				\
+	{ .class = cls, .nr = tm_spd_max(cls),				\
+	  .load = ld, .load_new = ld_new, .load_ckpt = ld_ckpt }
+
+#define tm_spd_max(cls)							\
+	((cls) == TM_SPD_GPR ? TM_SPD_NGPR :				\
+	 (cls) == TM_SPD_FPR ? TM_SPD_NFPR : TM_SPD_NVSX)
+
+const char *tm_spd_class_name(enum tm_spd_class class);
+int tm_spd_fill_parse(const char *name, enum tm_spd_fill *fill);
+
+void tm_spd_fill(struct tm_spd *spd, enum tm_spd_fill fill, unsigned long seed);
+
+/* Make spd the one the kernel runs, returns the cycle for its class */
+tm_cycle_t tm_spd_select(struct tm_spd *spd);
+
+/* A traced body: the stop dooms the transaction, so it must fail */
+void tm_spd_tracee(void);
+
+#endif /* _TM_SPD_H */
@@ -0,0 +1,166 @@
+/*
+ * TM suspend/resume stress mode, see tm_stress.h
+ *
+ * Licensed under GPLv2.
+ */
+#define _GNU_SOURCE	/* For CPU_ZERO etc. */
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "tm_stress.h"
+
+/* 100, 10k or 5m */
+static unsigned long tm_stress_count(const char *s)
+{
+	char *end;
+	unsigned long n = strtoul(s, &end, 0);
+
+	if (*end == 'k' || *end == 'K')
+		n *= 1000;
+	else if (*end == 'm' || *end == 'M')
+		n *= 1000000;
+	return n;
+}
+
+void tm_stress_defaults(struct tm_stress_opts *opts)
+{
+	opts->cycles = 0;
+	opts->threads = 1;
+	opts->format = TEXASR_TEXT;
+}
+
+/*
+ * -n <cycles> selects the stress mode, -t <threads> spreads it and
+ * -f text|json|subunit picks the abort report format. Returns non zero
+ * if c is none of them or arg is not valid for it.
+ */
+int tm_stress_option(int c, const char *arg, struct tm_stress_opts *opts)
+{
+	switch (c) {
+	case 'n':
+		opts->cycles = tm_stress_count(arg);
+		return 0;
+	case 't':
+		opts->threads = atoi(arg);
+		if (opts->threads < 1)
+			opts->threads = 1;
+		return 0;
+	case 'f':
+		return texasr_format_parse(arg, &opts->format);
+	}
+	return -1;
+}
+
+static void *tm_stress_thread(void *arg)
+{
+	struct tm_stress_stats *st = arg;
+	struct texasr_info info;
+	unsigned long i, texasr;
+	u64 start_ns, start;
+	cpu_set_t mask;
+
+	if (st->cpu >= 0) {
+		CPU_ZERO(&mask);
+		CPU_SET(st->cpu, &mask);
+		if (sched_setaffinity(0, sizeof(mask), &mask))
+			perror("sched_setaffinity");
+	}
+
+	texasr_counters_register(&st->aborts);
+
+	start_ns = monotonic_ns();
+	start = tm_stress_tb();
+	for (i = 0; i < st->cycles; i++) {
+		if (!st->cycle(&texasr)) {
+			st->commits++;
+			continue;
+		}
+		texasr_decode(texasr, &info);
+		texasr_count(&st->aborts, &info);
+	}
+	st->tb = tm_stress_tb() - start;
+	st->ns = monotonic_ns() - start_ns;
+	return NULL;
+}
+
+static void tm_stress_report(const char *name, struct tm_stress_opts *opts,
+			     u64 commits, u64 tb, u64 ns, u64 wall_ns)
+{
+	struct texasr_counters aborts;
+	char prefix[64];
+	u64 total;
+
+	texasr_counters_sum(&aborts);
+	total = commits + aborts.events;
+	if (!total || !wall_ns)
+		return;
+
+	printf("%s: %d threads, %llu transactions in %llu ms\n", name,
+	       opts->threads, total, wall_ns / 1000000);
+	printf("%s: %llu commits (%.4f%%), %llu aborts, %.0f aborts/s\n", name,
+	       commits, 100.0 * commits / total, aborts.events,
+	       aborts.events * 1e9 / wall_ns);
+	printf("%s: %.1f tb ticks/tx, %.1f ns/tx per thread\n", name,
+	       (double)tb / total, (double)ns / total);
+
+	if (!aborts.events)
+		return;
+
+	snprintf(prefix, sizeof(prefix), "%s: ", name);
+	texasr_counters_print(stdout, prefix, &aborts, opts->format);
+}
+
+int tm_stress(const char *name, tm_cycle_t cycle, struct tm_stress_opts *opts)
+{
+	struct tm_stress_stats *stats;
+	struct cpu_pool pool;
+	pthread_t *tids;
+	bool have_pool;
+	u64 start, commits = 0, tb = 0, ns = 0;
+	int i, started, ret = TEST_PASS;
+
+	stats = aligned_alloc(CACHE_LINE_SIZE, opts->threads * sizeof(*stats));
+	tids = calloc(opts->threads, sizeof(*tids));
+	if (!stats || !tids) {
+		perror("malloc");
+		free(stats);
+		free(tids);
+		return TEST_FAIL;
+	}
+	memset(stats, 0, opts->threads * sizeof(*stats));
+
+	have_pool = !cpu_pool_init(&pool);
+	for (i = 0; i < opts->threads; i++) {
+		stats[i].cycle = cycle;
+		stats[i].cycles = opts->cycles / opts->threads +
+				  (i < opts->cycles % opts->threads);
+		stats[i].cpu = have_pool ? cpu_pool_alloc(&pool, CPU_DISTINCT_CORES) : -1;
+	}
+	if (have_pool)
+		cpu_pool_fini(&pool);
+
+	start = monotonic_ns();
+	for (started = 0; started < opts->threads; started++) {
+		errno = pthread_create(&tids[started], NULL, tm_stress_thread, &stats[started]);
+		if (errno) {
+			perror("pthread_create");
+			ret = TEST_FAIL;
+			break;
+		}
+	}
+	for (i = 0; i < started; i++)
+		pthread_join(tids[i], NULL);
+
+	for (i = 0; i < started; i++) {
+		commits += stats[i].commits;
+		tb += stats[i].tb;
+		ns += stats[i].ns;
+	}
+	tm_stress_report(name, opts, commits, tb, ns, monotonic_ns() - start);
+	texasr_counters_reset();
+
+	free(stats);
+	free(tids);
+	return ret;
+}
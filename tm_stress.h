@@ -0,0 +1,71 @@
+/*
+ * TM suspend/resume stress mode
+ *
+ * Runs a test's TBEGIN, load, TSUSPEND, load, TRESUME, TEND cycle many
+ * times, on one or more threads each pinned to its own core, and
+ * reports the commit rate, aborts per second, timebase ticks per
+ * transaction and the aborts broken down by texasr.h.
+ *
+ * Licensed under GPLv2.
+ */
+#ifndef _TM_STRESS_H
+#define _TM_STRESS_H
+
+#include "ptrace.h"
+
+/*
+ * Clobbers for the tm_spd() asm bodies. They "bl" into C functions,
+ * which may change any volatile register, and since the stress mode
+ * they return to their caller instead of exiting. FPR and VMX loads
+ * also reach the non volatile halves of the VSX file.
+ */
+#define TM_CALL_CLOBBERS \
+	"lr", "ctr", "xer", "cr0", "cr1", "cr5", "cr6", "cr7", \
+	"r0", "r3", "r4", "r5", "r6", "r7", "r8", "r9", \
+	"r10", "r11", "r12", "vs0", "vs1", "vs2", "vs3", "vs4", \
+	"vs5", "vs6", "vs7", "vs8", "vs9", "vs10", "vs11", "vs12", \
+	"vs13", "vs32", "vs33", "vs34", "vs35", "vs36", "vs37", "vs38", \
+	"vs39", "vs40", "vs41", "vs42", "vs43", "vs44", "vs45", "vs46", \
+	"vs47", "vs48", "vs49", "vs50", "vs51"
+#define TM_FPR_CLOBBERS \
+	"vs14", "vs15", "vs16", "vs17", "vs18", "vs19", "vs20", "vs21", \
+	"vs22", "vs23", "vs24", "vs25", "vs26", "vs27", "vs28", "vs29", \
+	"vs30", "vs31"
+#define TM_VMX_CLOBBERS \
+	"vs52", "vs53", "vs54", "vs55", "vs56", "vs57", "vs58", "vs59", \
+	"vs60", "vs61", "vs62", "vs63"
+
+/* One pass of the cycle: returns non zero and sets *texasr on abort */
+typedef int (*tm_cycle_t)(unsigned long *texasr);
+
+struct tm_stress_opts {
+	unsigned long cycles;		/* in total, split over the threads */
+	int threads;
+	enum texasr_format format;
+};
+
+/* Private to one thread, so nothing is shared in the loop */
+struct tm_stress_stats {
+	tm_cycle_t cycle;
+	unsigned long cycles;
+	int cpu;
+	u64 commits;
+	u64 tb;				/* timebase ticks spent in the loop */
+	u64 ns;
+	struct texasr_counters aborts;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+static inline u64 tm_stress_tb(void)
+{
+#ifdef __powerpc__
+	return __builtin_ppc_get_timebase();
+#else
+	return monotonic_ns();
+#endif
+}
+
+void tm_stress_defaults(struct tm_stress_opts *opts);
+int tm_stress_option(int c, const char *arg, struct tm_stress_opts *opts);
+int tm_stress(const char *name, tm_cycle_t cycle, struct tm_stress_opts *opts);
+
+#endif /* _TM_STRESS_H */
@@ -0,0 +1,304 @@
+/*
+ * TM transition microbenchmark
+ *
+ * Times TBEGIN, TSUSPEND, TRESUME and TEND one by one with mftb around
+ * each, and the empty TBEGIN/TEND round trip, in timebase ticks. What
+ * runs while suspended is timed too: nothing (the cost of mftb
+ * itself), a getppid() syscall and, under a tracer, a breakpoint stop.
+ * Only committed transactions count, except for the stop, which dooms
+ * the transaction and is timed from inside the suspended section.
+ *
+ * Every kernel runs warm, back to back after a warm up, and cold,
+ * after a sleep and a write over a buffer larger than the caches. The
+ * report gives min, median, mean, standard deviation and max in ticks
+ * and the mean in ns, from the timebase calibrated against
+ * CLOCK_MONOTONIC. It all runs twice: untraced, then again in a child
+ * seized by trace_breakpoints().
+ *
+ * -n sets the warm samples per kernel.
+ *
+ * Licensed under GPLv2.
+ */
+#include <math.h>
+#include <sys/syscall.h>
+
+#include "tm_stress.h"
+#include "tracer.h"
+
+#define TIMING_WARM		10000
+#define TIMING_WARMUP		1000
+#define TIMING_COLD		100
+#define TIMING_COLD_SLEEP_US	1000
+#define TIMING_EVICT		(16 << 20)
+#define TIMING_CALIBRATE_US	100000
+#define TIMING_DELTAS		5
+
+static unsigned long warm_runs = TIMING_WARM;
+static double ns_per_tick;
+static char *evict;
+
+/* Ticks tm_timing_stop() took, stored while suspended so they survive the abort */
+static u64 stop_tb;
+
+__attribute__((used, noinline)) void tm_timing_break_here(void)
+{
+	asm volatile("" ::: "memory");
+}
+
+__attribute__((used)) void tm_timing_syscall(void)
+{
+	syscall(SYS_getppid);
+}
+
+__attribute__((used)) void tm_timing_stop(void)
+{
+	u64 start = tm_stress_tb();
+
+	tm_timing_break_here();
+	stop_tb = tm_stress_tb() - start;
+}
+
+/* The transitions around call, non zero if the transaction failed */
+#define TIMING_KERNEL(fn, call)						\
+static int fn(u64 *d)							\
+{									\
+	unsigned long t0, t1, t2, t3, t4, t5, abort;			\
+									\
+	asm __volatile__(						\
+		"mftb %[t0];"						\
+		TBEGIN							\
+		"beq 1f;"						\
+		"mftb %[t1];"						\
+		TSUSPEND						\
+		"mftb %[t2];"						\
+		call							\
+		"mftb %[t3];"						\
+		TRESUME							\
+		"mftb %[t4];"						\
+		TEND							\
+		"mftb %[t5];"						\
+		"li %[abrt], 0;"					\
+		"b 2f;"							\
+									\
+		"1: ;"							\
+		"li %[abrt], 1;"					\
+									\
+		"2: ;"							\
+		: [abrt] "=&r" (abort), [t0] "=&r" (t0), [t1] "=&r" (t1), \
+		  [t2] "=&r" (t2), [t3] "=&r" (t3), [t4] "=&r" (t4),	\
+		  [t5] "=&r" (t5)					\
+		:							\
+		: "memory", TM_CALL_CLOBBERS				\
+		);							\
+									\
+	if (abort)							\
+		return 1;						\
+	d[0] = t1 - t0;							\
+	d[1] = t2 - t1;							\
+	d[2] = t3 - t2;							\
+	d[3] = t4 - t3;							\
+	d[4] = t5 - t4;							\
+	return 0;							\
+}
+
+TIMING_KERNEL(timing_null, "")
+TIMING_KERNEL(timing_syscall, "bl tm_timing_syscall;")
+TIMING_KERNEL(timing_stop_cycle, "bl tm_timing_stop;")
+
+static int timing_empty(u64 *d)
+{
+	unsigned long t0, t1, abort;
+
+	asm __volatile__(
+		"mftb %[t0];"
+		TBEGIN
+		"beq 1f;"
+		TEND
+		"li %[abrt], 0;"
+		"b 2f;"
+
+		"1: ;"
+		"li %[abrt], 1;"
+
+		"2: ;"
+		"mftb %[t1];"
+		: [abrt] "=&r" (abort), [t0] "=&r" (t0), [t1] "=&r" (t1)
+		:
+		: "memory", "cr0"
+		);
+
+	d[0] = t1 - t0;
+	return abort;
+}
+
+/* A sample unless the transaction survived the stop */
+static int timing_stop(u64 *d)
+{
+	if (!timing_stop_cycle(d))
+		return 1;
+	d[0] = stop_tb;
+	return 0;
+}
+
+static const char * const empty_deltas[] = { "TBEGIN/TEND" };
+static const char * const null_deltas[] = { "TBEGIN", "TSUSPEND", "mftb", "TRESUME", "TEND" };
+static const char * const syscall_deltas[] = { "TBEGIN", "TSUSPEND", "getppid", "TRESUME", "TEND" };
+static const char * const stop_deltas[] = { "stop" };
+
+static const struct timing_kernel {
+	const char *name;
+	int (*fn)(u64 *d);
+	const char * const *deltas;
+	int nr;
+	bool traced;			/* only under a tracer */
+} timing_kernels[] = {
+	{ "empty", timing_empty, empty_deltas, ARRAY_SIZE(empty_deltas), false },
+	{ "null", timing_null, null_deltas, ARRAY_SIZE(null_deltas), false },
+	{ "syscall", timing_syscall, syscall_deltas, ARRAY_SIZE(syscall_deltas), false },
+	{ "stop", timing_stop, stop_deltas, ARRAY_SIZE(stop_deltas), true },
+};
+
+/* Timebase against CLOCK_MONOTONIC over a short sleep */
+static double timing_calibrate(void)
+{
+	u64 tb, ns;
+
+	tb = tm_stress_tb();
+	ns = monotonic_ns();
+	usleep(TIMING_CALIBRATE_US);
+	tb = tm_stress_tb() - tb;
+	ns = monotonic_ns() - ns;
+	return tb ? (double)ns / tb : 0;
+}
+
+static void timing_evict(void)
+{
+	static unsigned char pass;
+
+	usleep(TIMING_COLD_SLEEP_US);
+	memset(evict, ++pass, TIMING_EVICT);
+}
+
+static int timing_cmp(const void *a, const void *b)
+{
+	u64 x = *(const u64 *)a, y = *(const u64 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void timing_stats(const char *prefix, const char *what, u64 *s, unsigned long n)
+{
+	double mean = 0, var = 0;
+	unsigned long i;
+
+	if (!n)
+		return;
+
+	qsort(s, n, sizeof(*s), timing_cmp);
+	for (i = 0; i < n; i++)
+		mean += s[i];
+	mean /= n;
+	for (i = 0; i < n; i++)
+		var += (s[i] - mean) * (s[i] - mean);
+	var /= n;
+
+	printf("%s %-11s min %llu median %llu mean %.2f sd %.2f max %llu ticks, "
+	       "mean %.1f ns\n", prefix, what, s[0], s[n / 2], mean, sqrt(var),
+	       s[n - 1], mean * ns_per_tick);
+}
+
+/* samples[] has room for runs samples of every delta */
+static void timing_run(const char *ctx, const struct timing_kernel *k, bool cold,
+		       unsigned long runs, u64 *samples)
+{
+	unsigned long i, n = 0, aborted = 0;
+	char prefix[64];
+	u64 d[TIMING_DELTAS];
+	int j;
+
+	if (!cold)
+		for (i = 0; i < TIMING_WARMUP; i++)
+			k->fn(d);
+
+	for (i = 0; i < runs; i++) {
+		if (cold)
+			timing_evict();
+		if (k->fn(d)) {
+			aborted++;
+			continue;
+		}
+		for (j = 0; j < k->nr; j++)
+			samples[j * runs + n] = d[j];
+		n++;
+	}
+
+	snprintf(prefix, sizeof(prefix), "tm_timing: %s %s %-7s", ctx,
+		 cold ? "cold" : "warm", k->name);
+	for (j = 0; j < k->nr; j++)
+		timing_stats(prefix, k->deltas[j], &samples[j * runs], n);
+	if (aborted)
+		printf("%s %lu of %lu lost\n", prefix, aborted, runs);
+}
+
+static int timing_all(const char *ctx, bool traced)
+{
+	unsigned long runs = warm_runs > TIMING_COLD ? warm_runs : TIMING_COLD;
+	u64 *samples;
+	unsigned int i;
+
+	samples = calloc(TIMING_DELTAS * runs, sizeof(*samples));
+	if (!samples) {
+		perror("calloc");
+		return TEST_FAIL;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(timing_kernels); i++) {
+		if (timing_kernels[i].traced && !traced)
+			continue;
+		timing_run(ctx, &timing_kernels[i], false, warm_runs, samples);
+		timing_run(ctx, &timing_kernels[i], true, TIMING_COLD, samples);
+	}
+
+	free(samples);
+	return TEST_PASS;
+}
+
+static void timing_tracee(void)
+{
+	exit(timing_all("traced", true));
+}
+
+/* Nothing to look at, the stop itself is what is timed */
+static int timing_check(pid_t child, int hit, void *arg)
+{
+	return TEST_PASS;
+}
+
+static int tm_timing(void)
+{
+	SKIP_IF(!cpu_caps.htm);
+
+	evict = malloc(TIMING_EVICT);
+	if (!evict) {
+		perror("malloc");
+		return TEST_FAIL;
+	}
+	memset(evict, 0, TIMING_EVICT);
+
+	ns_per_tick = timing_calibrate();
+	printf("tm_timing: timebase %.3f MHz, %.3f ns per tick\n",
+	       1e3 / ns_per_tick, ns_per_tick);
+
+	if (timing_all("untraced", false))
+		return TEST_FAIL;
+	return trace_breakpoints("tm_timing", timing_tracee, "tm_timing_break_here",
+				 timing_check, NULL);
+}
+
+static int tm_timing_stress(struct tm_stress_opts *opts)
+{
+	warm_runs = opts->cycles;
+	return tm_timing();
+}
+
+TEST_REGISTER_STRESS(tm_timing, "tm_timing", tm_timing_stress);
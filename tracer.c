@@ -0,0 +1,311 @@
+/*
+ * Breakpoint driven tracer, see tracer.h
+ *
+ * Licensed under GPLv2.
+ */
+#define _GNU_SOURCE	/* For process_vm_readv/writev */
+
+#include <limits.h>
+
+#include "core.h"
+#include "tracer.h"
+
+#if defined(__powerpc__)
+#define TRAP_INSN	0x7fe00008	/* tw 31,0,0 */
+#define TRAP_LEN	4
+#define TRAP_PC		offsetof(struct pt_regs, nip)
+#define TRAP_PC_SKEW	0		/* tw leaves nip on it */
+#elif defined(__x86_64__)
+#define TRAP_INSN	0xcc		/* int3 */
+#define TRAP_LEN	1
+#define TRAP_PC		offsetof(struct user_regs_struct, rip)
+#define TRAP_PC_SKEW	TRAP_LEN	/* int3 leaves rip past it */
+#else
+#error "No breakpoint instruction for this architecture"
+#endif
+
+struct breakpoint {
+	pid_t pid;
+	unsigned long addr;
+	long orig;			/* text word the trap went into */
+	int hits;
+};
+
+static int bp_insert(struct breakpoint *bp)
+{
+	u32 trap = TRAP_INSN;
+	long word;
+
+	errno = 0;
+	bp->orig = ptrace(PTRACE_PEEKTEXT, bp->pid, bp->addr, NULL);
+	if (errno) {
+		perror("ptrace(PTRACE_PEEKTEXT) failed");
+		return TEST_FAIL;
+	}
+
+	word = bp->orig;
+	memcpy(&word, &trap, TRAP_LEN);
+	if (ptrace(PTRACE_POKETEXT, bp->pid, bp->addr, word)) {
+		perror("ptrace(PTRACE_POKETEXT) failed");
+		return TEST_FAIL;
+	}
+	return TEST_PASS;
+}
+
+static int bp_remove(struct breakpoint *bp)
+{
+	if (ptrace(PTRACE_POKETEXT, bp->pid, bp->addr, bp->orig)) {
+		perror("ptrace(PTRACE_POKETEXT) failed");
+		return TEST_FAIL;
+	}
+	return TEST_PASS;
+}
+
+/* 1 if the tracee stopped on the breakpoint, 0 on a trap of its own */
+static int bp_hit(struct breakpoint *bp)
+{
+	unsigned long pc;
+
+	errno = 0;
+	pc = ptrace(PTRACE_PEEKUSER, bp->pid, TRAP_PC, NULL);
+	if (errno) {
+		perror("ptrace(PTRACE_PEEKUSER) failed");
+		return -1;
+	}
+	return pc - TRAP_PC_SKEW == bp->addr;
+}
+
+/* Point the tracee back at the trapping instruction */
+static int bp_rewind(struct breakpoint *bp)
+{
+	if (TRAP_PC_SKEW &&
+	    ptrace(PTRACE_POKEUSER, bp->pid, TRAP_PC, bp->addr)) {
+		perror("ptrace(PTRACE_POKEUSER) failed");
+		return TEST_FAIL;
+	}
+	return TEST_PASS;
+}
+
+/*
+ * Execute the instruction under the trap and re-arm it. A signal that
+ * arrives meanwhile is held back until the tracee is past the trap,
+ * so that a handler does not run into it a second time.
+ */
+static int bp_step(struct breakpoint *bp, struct trace_session *s)
+{
+	int sig = 0;
+
+	if (bp_remove(bp))
+		return TEST_FAIL;
+
+	for (;;) {
+		if (step_trace(bp->pid) || wait_trace(bp->pid))
+			return TEST_FAIL;
+		if (!s->event && s->sig == SIGTRAP)
+			break;
+		if (s->sig)
+			sig = s->sig;
+		s->sig = 0;
+	}
+	s->sig = sig;
+
+	return bp_insert(bp);
+}
+
+/* With TRACER_CORE_DIR set, failed stops are saved there as core files */
+static void tracer_save_core(const char *name, pid_t pid, int hit)
+{
+	const char *dir = getenv("TRACER_CORE_DIR");
+	char path[PATH_MAX];
+
+	if (!dir)
+		return;
+	snprintf(path, sizeof(path), "%s/%s-%d-%d.core", dir, name, pid, hit);
+	if (!snapshot_core(pid, path))
+		printf("%s: registers saved to %s\n", name, path);
+}
+
+int trace_breakpoints(const char *name, void (*body)(void), const char *symbol,
+		      break_check_t check, void *arg)
+{
+	struct breakpoint bp = { 0 };
+	struct regset_cache cache;
+	struct trace_session *s;
+	int go[2], hit, ret = TEST_PASS;
+	pid_t pid;
+	char c;
+
+	bp.addr = elf_symbol(symbol);
+	if (!bp.addr) {
+		printf("%s: no symbol %s to break on\n", name, symbol);
+		return TEST_FAIL;
+	}
+
+	if (pipe(go)) {
+		perror("pipe");
+		return TEST_FAIL;
+	}
+	pid = fork();
+	if (pid == -1) {
+		perror("fork");
+		return TEST_FAIL;
+	}
+	if (pid == 0) {
+		/* Hold still until seized and armed */
+		close(go[1]);
+		if (read(go[0], &c, 1) < 0)
+			exit(1);
+		body();
+		exit(0);
+	}
+	close(go[0]);
+	bp.pid = pid;
+
+	/* The checks share one fetch of each regset per stop */
+	if (start_trace(pid) || regcache_attach(&cache, pid) || bp_insert(&bp) ||
+	    cont_trace(pid))
+		goto kill;
+	close(go[1]);
+	go[1] = -1;
+
+	s = trace_session(pid);
+	for (;;) {
+		if (wait_trace(pid)) {
+			if (s->state == TRACEE_EXITED)
+				break;
+			goto kill;
+		}
+
+		/* Group-stops, events and the tracee's own signals and traps */
+		hit = !s->event && s->sig == SIGTRAP ? bp_hit(&bp) : 0;
+		if (hit < 0)
+			goto kill;
+		if (!hit) {
+			if (cont_trace(pid))
+				goto kill;
+			continue;
+		}
+		s->sig = 0;
+
+		if (!bp.hits)
+			test_mark_stop();
+		if (bp_rewind(&bp))
+			goto kill;
+		if (check(pid, bp.hits++, arg)) {
+			tracer_save_core(name, pid, bp.hits - 1);
+			ret = TEST_FAIL;
+		}
+
+		if (bp_step(&bp, s) || cont_trace(pid))
+			goto kill;
+	}
+	regcache_detach(&cache);
+
+	if (WIFSIGNALED(s->status)) {
+		printf("%s: tracee killed by signal %d\n", name, WTERMSIG(s->status));
+		return TEST_FAIL;
+	}
+	if (!bp.hits) {
+		printf("%s: tracee never reached %s\n", name, symbol);
+		return TEST_FAIL;
+	}
+	printf("%s: %d stops at %s\n", name, bp.hits, symbol);
+	return ret ? ret : WEXITSTATUS(s->status);
+
+kill:
+	regcache_detach(&cache);
+	if (go[1] >= 0)
+		close(go[1]);
+	kill_trace(pid);
+	return TEST_FAIL;
+}
+
+int tracer_expect(const char *what, const unsigned long *got,
+		  const unsigned long *want, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		if (got[i] != want[i]) {
+			printf("%s[%d]: %lx, expected %lx\n", what, i, got[i], want[i]);
+			return TEST_FAIL;
+		}
+	}
+	return TEST_PASS;
+}
+
+int tracee_bufs_resolve(struct tracee_buf *bufs, int nr)
+{
+	const char *names[TRACEE_BUFS_MAX] = { NULL };
+	unsigned long addrs[TRACEE_BUFS_MAX];
+	int i;
+
+	if (nr > TRACEE_BUFS_MAX) {
+		printf("Too many tracee buffers\n");
+		return TEST_FAIL;
+	}
+
+	for (i = 0; i < nr; i++)
+		names[i] = bufs[i].symbol;
+	elf_symbols(names, addrs, nr);
+
+	for (i = 0; i < nr; i++) {
+		if (!addrs[i]) {
+			printf("No symbol %s in the tracee\n", bufs[i].symbol);
+			return TEST_FAIL;
+		}
+		bufs[i].addr = addrs[i];
+	}
+	return TEST_PASS;
+}
+
+int tracee_bufs_read(pid_t child, struct tracee_buf *bufs, int nr)
+{
+	struct iovec local[TRACEE_BUFS_MAX], remote[TRACEE_BUFS_MAX];
+	ssize_t want = 0, got;
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		local[i].iov_base = bufs[i].buf;
+		local[i].iov_len = bufs[i].len;
+		remote[i].iov_base = (void *)bufs[i].addr;
+		remote[i].iov_len = bufs[i].len;
+		want += bufs[i].len;
+	}
+
+	got = process_vm_readv(child, local, nr, remote, nr, 0);
+	if (got != want) {
+		if (got < 0)
+			perror("process_vm_readv");
+		else
+			printf("Short read of tracee buffers: %zd of %zd\n", got, want);
+		return TEST_FAIL;
+	}
+	return TEST_PASS;
+}
+
+/* Counterpart of tracee_bufs_read(), eg. to hand the tracee what a check saw */
+int tracee_bufs_write(pid_t child, struct tracee_buf *bufs, int nr)
+{
+	struct iovec local[TRACEE_BUFS_MAX], remote[TRACEE_BUFS_MAX];
+	ssize_t want = 0, got;
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		local[i].iov_base = bufs[i].buf;
+		local[i].iov_len = bufs[i].len;
+		remote[i].iov_base = (void *)bufs[i].addr;
+		remote[i].iov_len = bufs[i].len;
+		want += bufs[i].len;
+	}
+
+	got = process_vm_writev(child, local, nr, remote, nr, 0);
+	if (got != want) {
+		if (got < 0)
+			perror("process_vm_writev");
+		else
+			printf("Short write of tracee buffers: %zd of %zd\n", got, want);
+		return TEST_FAIL;
+	}
+	return TEST_PASS;
+}
@@ -0,0 +1,54 @@
+/*
+ * Breakpoint driven tracer
+ *
+ * Forks a test body, seizes it through a ptrace.h tracer session and
+ * plants a trap on a rendezvous function, <test>_break_here() in the
+ * tests, found in the executable's symbol table. Each hit stops the
+ * tracee straight into the tracer, which runs the test's show_*() and
+ * write_*() checks, steps the tracee over the trap and lets it run on
+ * to the next hit or its exit. SIGTRAPs from anywhere else, such as
+ * sigframe_break(), are the tracee's own and delivered to it.
+ *
+ * Licensed under GPLv2.
+ */
+#ifndef _TRACER_H
+#define _TRACER_H
+
+#include "ptrace.h"
+
+/* Run at each hit, counted from 0, with the tracee stopped on the trap */
+typedef int (*break_check_t)(pid_t child, int hit, void *arg);
+
+/*
+ * Run body() in a traced child and call check() at every hit of symbol.
+ * The checks run with a regset cache attached: each regset is fetched
+ * once per stop and their writes are written back before the tracee
+ * moves on. Fails if any check does or the symbol is never reached,
+ * otherwise returns the exit status of the child.
+ */
+int trace_breakpoints(const char *name, void (*body)(void), const char *symbol,
+		      break_check_t check, void *arg);
+
+/* Compare what a check read against what the tracee loaded */
+int tracer_expect(const char *what, const unsigned long *got,
+		  const unsigned long *want, int nr);
+
+/*
+ * Tracee buffers to verify registers against, eg. the arrays the test
+ * loaded them from. Their addresses are looked up once, then every
+ * check pulls them all in with a single process_vm_readv().
+ */
+struct tracee_buf {
+	const char *symbol;
+	void *buf;			/* local copy */
+	size_t len;
+	unsigned long addr;		/* set by tracee_bufs_resolve() */
+};
+
+#define TRACEE_BUFS_MAX	16
+
+int tracee_bufs_resolve(struct tracee_buf *bufs, int nr);
+int tracee_bufs_read(pid_t child, struct tracee_buf *bufs, int nr);
+int tracee_bufs_write(pid_t child, struct tracee_buf *bufs, int nr);
+
+#endif /* _TRACER_H */
@@ -11,77 +11,284 @@
 #include <link.h>
 #include <sched.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "utils.h"
 
 static char auxv[4096];
+static ssize_t auxv_len = -1;
 
-void *get_auxv_entry(int type)
+/* Shared with the harness while running under it, NULL otherwise */
+struct test_stats *test_stats;
+
+u64 monotonic_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Called at the first point a tracer sees the tracee stopped */
+void test_mark_stop(void)
+{
+	if (test_stats && !test_stats->first_stop_ns)
+		test_stats->first_stop_ns = monotonic_ns();
+}
+
+static int read_auxv(void)
 {
-	ElfW(auxv_t) *p;
-	void *result;
 	ssize_t num;
 	int fd;
 
 	fd = open("/proc/self/auxv", O_RDONLY);
 	if (fd == -1) {
 		perror("open");
-		return NULL;
+		return -1;
 	}
 
-	result = NULL;
-
 	num = read(fd, auxv, sizeof(auxv));
+	close(fd);
 	if (num < 0) {
 		perror("read");
-		goto out;
+		return -1;
 	}
 
-	if (num > sizeof(auxv)) {
+	if (num >= sizeof(auxv)) {
 		printf("Overflowed auxv buffer\n");
+		return -1;
+	}
+
+	auxv_len = num;
+	return 0;
+}
+
+/* The auxv never changes, so it is only read on the first call */
+void *get_auxv_entry(int type)
+{
+	ElfW(auxv_t) *p;
+
+	if (auxv_len < 0 && read_auxv())
+		return NULL;
+
+	for (p = (ElfW(auxv_t) *)auxv; p->a_type != AT_NULL; p++)
+		if (p->a_type == type)
+			return (void *)p->a_un.a_val;
+
+	return NULL;
+}
+
+static int main_bias(struct dl_phdr_info *info, size_t size, void *data)
+{
+	/* The executable is always reported first */
+	*(ElfW(Addr) *)data = info->dlpi_addr;
+	return 1;
+}
+
+/* Run time address of a symbol, see elf_symbols() */
+static unsigned long sym_addr(const ElfW(Sym) *sym, ElfW(Addr) bias)
+{
+	unsigned long addr = sym->st_value + bias;
+
+	if (ELF64_ST_TYPE(sym->st_info) == STT_FUNC) {
+#if defined(__powerpc64__) && _CALL_ELF == 2
+		/* Skip the TOC setup of the global entry point */
+		addr += PPC64_LOCAL_ENTRY_OFFSET(sym->st_other);
+#elif defined(__powerpc64__)
+		/* ELFv1 symbols name the function descriptor */
+		addr = *(unsigned long *)addr;
+#endif
+	}
+	return addr;
+}
+
+/*
+ * Run time addresses of functions and objects of the executable, looked
+ * up in one pass over its symbol table. Names it does not have get 0.
+ * Functions resolve to the entry point a local "bl" lands on, which is
+ * where a breakpoint has to go. Returns how many were found.
+ */
+int elf_symbols(const char * const *names, unsigned long *addrs, int nr)
+{
+	static const unsigned int types[] = { SHT_SYMTAB, SHT_DYNSYM };
+	const ElfW(Ehdr) *ehdr;
+	const ElfW(Shdr) *shdr;
+	const ElfW(Sym) *sym;
+	ElfW(Addr) bias = 0;
+	const char *strtab;
+	int fd, i, n, found = 0;
+	unsigned int t;
+	struct stat st;
+	size_t j;
+	void *map;
+
+	for (n = 0; n < nr; n++)
+		addrs[n] = 0;
+
+	fd = open("/proc/self/exe", O_RDONLY);
+	if (fd == -1) {
+		perror("open");
+		return 0;
+	}
+	if (fstat(fd, &st)) {
+		perror("fstat");
+		close(fd);
+		return 0;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		perror("mmap");
+		return 0;
+	}
+
+	ehdr = map;
+	if (memcmp(ehdr->e_ident, ELFMAG, SELFMAG) || !ehdr->e_shoff)
 		goto out;
+	shdr = (const ElfW(Shdr) *)((char *)map + ehdr->e_shoff);
+	dl_iterate_phdr(main_bias, &bias);
+
+	/* The full symbol table first, the dynamic one if stripped */
+	for (t = 0; t < ARRAY_SIZE(types) && found < nr; t++) {
+		for (i = 0; i < ehdr->e_shnum && found < nr; i++) {
+			if (shdr[i].sh_type != types[t])
+				continue;
+			sym = (const ElfW(Sym) *)((char *)map + shdr[i].sh_offset);
+			strtab = (char *)map + shdr[shdr[i].sh_link].sh_offset;
+			for (j = 0; j < shdr[i].sh_size / sizeof(*sym); j++) {
+				if (sym[j].st_shndx == SHN_UNDEF)
+					continue;
+				for (n = 0; n < nr; n++) {
+					if (addrs[n] || strcmp(strtab + sym[j].st_name, names[n]))
+						continue;
+					addrs[n] = sym_addr(&sym[j], bias);
+					found++;
+				}
+			}
+		}
 	}
+out:
+	munmap(map, st.st_size);
+	return found;
+}
+
+unsigned long elf_symbol(const char *name)
+{
+	unsigned long addr;
+
+	elf_symbols(&name, &addr, 1);
+	return addr;
+}
+
+/* CPU capabilities */
+struct cpu_caps cpu_caps;
+
+static const struct {
+	const char *name;
+	int word;		/* 1: AT_HWCAP, 2: AT_HWCAP2 */
+	unsigned long bit;
+} cap_names[] = {
+	{ "altivec",	1, PPC_FEATURE_HAS_ALTIVEC },
+	{ "vsx",	1, PPC_FEATURE_HAS_VSX },
+	{ "arch_2_06",	1, PPC_FEATURE_ARCH_2_06 },
+	{ "arch_2_07",	2, PPC_FEATURE2_ARCH_2_07 },
+	{ "arch_3_00",	2, PPC_FEATURE2_ARCH_3_00 },
+	{ "htm",	2, PPC_FEATURE2_HTM },
+	{ "htm-nosc",	2, PPC_FEATURE2_HTM_NOSC },
+	{ "dscr",	2, PPC_FEATURE2_DSCR },
+	{ "ebb",	2, PPC_FEATURE2_EBB },
+	{ "tar",	2, PPC_FEATURE2_TAR },
+};
 
-	p = (ElfW(auxv_t) *)auxv;
+/* Apply a PPC_CAPS list: [+-]name[,[+-]name...] */
+static void override_caps(char *list)
+{
+	char *tok, *save;
+	unsigned long *word;
+	bool set;
+	int i;
+
+	for (tok = strtok_r(list, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		set = *tok != '-';
+		if (*tok == '-' || *tok == '+')
+			tok++;
 
-	while (p->a_type != AT_NULL) {
-		if (p->a_type == type) {
-			result = (void *)p->a_un.a_val;
-			break;
+		for (i = 0; i < ARRAY_SIZE(cap_names); i++)
+			if (!strcmp(tok, cap_names[i].name))
+				break;
+		if (i == ARRAY_SIZE(cap_names)) {
+			fprintf(stderr, "PPC_CAPS: unknown feature %s\n", tok);
+			continue;
 		}
 
-		p++;
+		word = cap_names[i].word == 1 ? &cpu_caps.hwcap : &cpu_caps.hwcap2;
+		if (set)
+			*word |= cap_names[i].bit;
+		else
+			*word &= ~cap_names[i].bit;
 	}
-out:
-	close(fd);
-	return result;
 }
 
-int pick_online_cpu(void)
+/*
+ * Install a set of capabilities, the real ones at startup or those of a
+ * simulated CPU later on. PPC_CAPS applies on top either way.
+ */
+void cpu_caps_set(unsigned long hwcap, unsigned long hwcap2)
 {
-	cpu_set_t mask;
-	int cpu;
+	char *env, list[256];
 
-	CPU_ZERO(&mask);
+	cpu_caps.hwcap = hwcap;
+	cpu_caps.hwcap2 = hwcap2;
 
-	if (sched_getaffinity(0, sizeof(mask), &mask)) {
-		perror("sched_getaffinity");
-		return -1;
+	env = getenv("PPC_CAPS");
+	if (env) {
+		snprintf(list, sizeof(list), "%s", env);
+		override_caps(list);
 	}
 
-	/* We prefer a primary thread, but skip 0 */
-	for (cpu = 8; cpu < CPU_SETSIZE; cpu += 8)
-		if (CPU_ISSET(cpu, &mask))
-			return cpu;
+	cpu_caps.altivec = have_hwcap(PPC_FEATURE_HAS_ALTIVEC);
+	cpu_caps.vsx = have_hwcap(PPC_FEATURE_HAS_VSX);
+	cpu_caps.htm = have_hwcap2(PPC_FEATURE2_HTM);
+	cpu_caps.htm_nosc = have_hwcap2(PPC_FEATURE2_HTM_NOSC);
+	cpu_caps.dscr = have_hwcap2(PPC_FEATURE2_DSCR);
+	cpu_caps.ebb = have_hwcap2(PPC_FEATURE2_EBB);
+	cpu_caps.tar = have_hwcap2(PPC_FEATURE2_TAR);
+
+	if (have_hwcap2(PPC_FEATURE2_ARCH_3_00))
+		cpu_caps.isa = 300;
+	else if (have_hwcap2(PPC_FEATURE2_ARCH_2_07))
+		cpu_caps.isa = 207;
+	else if (have_hwcap(PPC_FEATURE_ARCH_2_06))
+		cpu_caps.isa = 206;
+	else
+		cpu_caps.isa = 0;
+}
+
+__attribute__((constructor)) static void init_cpu_caps(void)
+{
+	cpu_caps_set((unsigned long)get_auxv_entry(AT_HWCAP),
+		     (unsigned long)get_auxv_entry(AT_HWCAP2));
+}
+
+/* We prefer a primary thread, but not on CPU 0's core */
+int pick_online_cpu(void)
+{
+	struct cpu_pool pool;
+	int cpu;
+
+	if (cpu_pool_init(&pool))
+		return -1;
 
-	/* Search for anything, but in reverse */
-	for (cpu = CPU_SETSIZE - 1; cpu >= 0; cpu--)
-		if (CPU_ISSET(cpu, &mask))
-			return cpu;
+	cpu = cpu_pool_alloc(&pool, CPU_DISTINCT_CORES);
+	if (cpu < 0)
+		printf("No cpus in affinity mask?!\n");
 
-	printf("No cpus in affinity mask?!\n");
-	return -1;
+	cpu_pool_fini(&pool);
+	return cpu;
 }
@@ -19,14 +19,165 @@ typedef uint32_t u32;
 typedef uint16_t u16;
 typedef uint8_t u8;
 
+/* POWER8 L1/L2 cache line */
+#define CACHE_LINE_SIZE	128
 
+
+/* AT_HWCAP / AT_HWCAP2 bits, for older uapi headers */
+#ifndef PPC_FEATURE_HAS_ALTIVEC
+#define PPC_FEATURE_HAS_ALTIVEC		0x10000000
+#endif
+#ifndef PPC_FEATURE_HAS_VSX
+#define PPC_FEATURE_HAS_VSX		0x00000080
+#endif
+#ifndef PPC_FEATURE_ARCH_2_06
+#define PPC_FEATURE_ARCH_2_06		0x00000100
+#endif
+#ifndef PPC_FEATURE2_ARCH_2_07
+#define PPC_FEATURE2_ARCH_2_07		0x80000000
+#endif
+#ifndef PPC_FEATURE2_HTM
+#define PPC_FEATURE2_HTM		0x40000000
+#endif
+#ifndef PPC_FEATURE2_DSCR
+#define PPC_FEATURE2_DSCR		0x20000000
+#endif
+#ifndef PPC_FEATURE2_EBB
+#define PPC_FEATURE2_EBB		0x10000000
+#endif
+#ifndef PPC_FEATURE2_TAR
+#define PPC_FEATURE2_TAR		0x04000000
+#endif
+#ifndef PPC_FEATURE2_HTM_NOSC
+#define PPC_FEATURE2_HTM_NOSC		0x01000000
+#endif
+#ifndef PPC_FEATURE2_ARCH_3_00
+#define PPC_FEATURE2_ARCH_3_00		0x00800000
+#endif
+
+/*
+ * CPU capabilities, read once from the auxv at startup. The PPC_CAPS
+ * environment variable can force features on or off, eg.
+ * PPC_CAPS=-htm,+vsx, to exercise fallback paths on any machine.
+ */
+struct cpu_caps {
+	unsigned long hwcap;
+	unsigned long hwcap2;
+	int isa;		/* 206, 207, 300 or 0 if older */
+	bool altivec;
+	bool vsx;
+	bool htm;
+	bool htm_nosc;
+	bool dscr;
+	bool ebb;
+	bool tar;
+};
+
+extern struct cpu_caps cpu_caps;
+void cpu_caps_set(unsigned long hwcap, unsigned long hwcap2);
+
+struct tm_stress_opts;
+
+struct harness_test {
+	int (*function)(void);
+	char *name;
+	int (*stress)(struct tm_stress_opts *opts);	/* see tm_stress.h, optional */
+};
+
+/*
+ * Test registry: every TEST_REGISTER() linked into a program adds an
+ * entry to the harness_tests section, and for_each_test() walks them
+ * in link order.
+ */
+#define __TEST_REGISTER(fn, name, stress)				\
+	static const struct harness_test __harness_test_##fn		\
+	__attribute__((used, section("harness_tests"), aligned(sizeof(void *)))) = \
+		{ fn, name, stress }
+
+#define TEST_REGISTER(fn, name)		__TEST_REGISTER(fn, name, NULL)
+#define TEST_REGISTER_STRESS(fn, name, stress)	__TEST_REGISTER(fn, name, stress)
+
+extern const struct harness_test __start_harness_tests[];
+extern const struct harness_test __stop_harness_tests[];
+
+#define for_each_test(t)	\
+	for ((t) = __start_harness_tests; (t) < __stop_harness_tests; (t)++)
+
+/* Filled in by a test child, read by the harness once it exits */
+struct test_stats {
+	u64 start_ns;		/* child started running the test body */
+	u64 first_stop_ns;	/* first test_mark_stop(), 0 if none */
+};
+
+extern struct test_stats *test_stats;
+
+u64 monotonic_ns(void);
+void test_mark_stop(void);
+
+int run_test(int (test_function)(void), char *name);
 int test_harness(int (test_function)(void), char *name);
+int test_harness_parallel(struct harness_test *tests, int nr, int jobs);
 extern void *get_auxv_entry(int type);
+int elf_symbols(const char * const *names, unsigned long *addrs, int nr);
+unsigned long elf_symbol(const char *name);
 int pick_online_cpu(void);
 
+/* Topology aware CPU pool, see cpu_pool.c */
+enum cpu_policy {
+	CPU_DISTINCT_CORES,	/* one CPU per core, primary threads first */
+	CPU_SAME_CORE,		/* SMT siblings, filling one core at a time */
+	CPU_CROSS_SOCKET,	/* spread over sockets, nodes, then cores */
+};
+
+struct cpu_topo {
+	int cpu;
+	int core;		/* primary thread of the core */
+	int thread;		/* SMT thread number within the core */
+	int socket;
+	int node;
+	bool busy;
+};
+
+struct cpu_pool {
+	int nr;
+	struct cpu_topo *cpus;
+};
+
+int cpu_pool_init(struct cpu_pool *pool);
+void cpu_pool_fini(struct cpu_pool *pool);
+int cpu_pool_alloc(struct cpu_pool *pool, enum cpu_policy policy);
+void cpu_pool_free(struct cpu_pool *pool, int cpu);
+int cpu_policy_parse(const char *name, enum cpu_policy *policy);
+
+static inline bool have_hwcap(unsigned long ftr)
+{
+	return (cpu_caps.hwcap & ftr) == ftr;
+}
+
 static inline bool have_hwcap2(unsigned long ftr2)
 {
-	return ((unsigned long)get_auxv_entry(AT_HWCAP2) & ftr2) == ftr2;
+	return (cpu_caps.hwcap2 & ftr2) == ftr2;
+}
+
+/* Seeded test data; the state must not be 0 */
+static inline unsigned long xorshift64(unsigned long *state)
+{
+	unsigned long x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	return *state = x;
+}
+
+/* Random bits as a single, but never an infinity or NaN */
+static inline float random_finite_single(unsigned long *state)
+{
+	union { uint32_t bits; float f; } u = { .bits = xorshift64(state) };
+
+	if ((u.bits & 0x7f800000) == 0x7f800000)
+		u.bits ^= 0x00800000;
+	return u.f;
 }
 
 /* Yes, this is evil */
@@ -51,6 +202,8 @@ do {								\
 	}							\
 } while (0)
 
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
+
 #define _str(s) #s
 #define str(s) _str(s)
 
@@ -1,87 +1,112 @@
-#include "ptrace.h"
+#include "tm_spd.h"
+#include "sigframe.h"
+#include "tracer.h"
+
 #define VEC_MAX 128
+#define VSX_WRITE 0x5555aaaa5555aaaaUL
 
-extern void loadvsx(void *p, int tmp);
+unsigned long vsx_load[VEC_MAX];
+unsigned long vsx_load_new[VEC_MAX];
+unsigned long vsx_store[VEC_MAX];
+unsigned long vsx_load_ckpt[VEC_MAX];
 
-unsigned long fp_load[VEC_MAX];
-unsigned long fp_load_new[VEC_MAX];
-unsigned long fp_store[VEC_MAX];
-unsigned long fp_load_ckpt[VEC_MAX];
+static struct tm_spd vsx_spd = TM_SPD(TM_SPD_VSX, vsx_load, vsx_load_new, vsx_load_ckpt);
 
-__attribute__((used)) void load_vsx(void)
+/* The VSX regset has doubleword 1 of VSR0-31, loaded from every odd word */
+static void vsx_image(const unsigned long *load, unsigned long *vsx)
 {
-	loadvsx(fp_load, 0);
+	int i;
+
+	for (i = 0; i < 32; i++)
+		vsx[i] = load[2 * i + 1];
 }
 
-__attribute__((used)) void load_vsx_new(void)
+/* The tracee's copies of the arrays, read at every stop */
+static unsigned long tracee_load[VEC_MAX], tracee_ckpt[VEC_MAX];
+
+static struct tracee_buf loads[] = {
+	{ "vsx_load", tracee_load, sizeof(tracee_load) },
+	{ "vsx_load_ckpt", tracee_ckpt, sizeof(tracee_ckpt) },
+};
+
+/*
+ * At tm_spd_break_here: the VSRs hold vsx_load and their checkpoint
+ * vsx_load_ckpt. The live values are thrown away on TRESUME, so they
+ * can be rewritten.
+ */
+static int check_break(pid_t child, int hit, void *arg)
 {
-	loadvsx(fp_load_new, 0);
+	unsigned long vsx[32], want[32];
+	int i;
+
+	if (tracee_bufs_read(child, loads, ARRAY_SIZE(loads)))
+		return TEST_FAIL;
+
+	vsx_image(tracee_load, want);
+	if (show_vsx(child, vsx) || tracer_expect("vsx", vsx, want, 32))
+		return TEST_FAIL;
+	vsx_image(tracee_ckpt, want);
+	if (show_vsx_ckpt(child, vsx) || tracer_expect("ckpt vsx", vsx, want, 32))
+		return TEST_FAIL;
+
+	for (i = 0; i < 32; i++)
+		want[i] = VSX_WRITE;
+	memcpy(vsx, want, sizeof(vsx));
+	if (write_vsx(child, vsx) || show_vsx(child, vsx) ||
+	    tracer_expect("written vsx", vsx, want, 32))
+		return TEST_FAIL;
+	return TEST_PASS;
 }
 
-__attribute__((used)) void load_vsx_ckpt(void)
+static tm_cycle_t vsx_init(void)
 {
-	loadvsx(fp_load_ckpt, 0);
+	tm_spd_fill(&vsx_spd, TM_SPD_FILL_INDEX, 0);
+	return tm_spd_select(&vsx_spd);
 }
 
-__attribute__((used)) void break_here(void)
+static int ptrace_vsx(void)
 {
-	//while(!cptr[1]);
+	SKIP_IF(!cpu_caps.htm);
+
+	vsx_init();
+	if (tracee_bufs_resolve(loads, ARRAY_SIZE(loads)))
+		return TEST_FAIL;
+	return trace_breakpoints("vsx", tm_spd_tracee, "tm_spd_break_here", check_break, NULL);
 }
 
-void tm_spd_vsx(void)
+static int ptrace_vsx_stress(struct tm_stress_opts *opts)
 {
-	unsigned long abort, texasr;
-
-	asm __volatile__(
-		"bl load_vsx_ckpt;"
-
-		"1: ;"
-		TBEGIN
-		"beq 2f;"
-
-		"bl load_vsx_new;"
-		TSUSPEND
-		"bl load_vsx;"
-		"bl break_here;"
-		TRESUME
-
-		TEND
-		"li 0, 0;"
-		"ori %[abrt], 0, 0;"
-		"b 3f;"
-
-		"2: ;"
-		"li 0, 1;"
-		"ori %[abrt], 0, 0;"
-		"mfspr %[texasr], %[sprn_texasr];"
-
-		"3: ;"
-		: [abrt] "=r" (abort), [texasr] "=r" (texasr)
-		: [fp_load] "r" (fp_load), [fp_load_ckpt] "r" (fp_load_ckpt), [sprn_texasr] "i"  (SPRN_TEXASR)
-		: "memory", "r0", "r1", "r2", "r3", "r4", "r8", "r9", "r10", "r11"
-		);
-
-	if (abort)
-	  {
-	    printf("failed transaction (texasr %lx)\n", texasr);
-	    exit(1);
-	  }
-	exit(0);
+	SKIP_IF(!cpu_caps.htm);
+
+	return tm_stress("vsx", vsx_init(), opts);
 }
 
-int main(int argc, char *argv[])
-{
-	int i;
+TEST_REGISTER_STRESS(ptrace_vsx, "vsx", ptrace_vsx_stress);
 
-	SKIP_IF(!((long)get_auxv_entry(AT_HWCAP2) & PPC_FEATURE2_HTM));
+/* Only a thread that used VSX gets its VSRs saved in the frame */
+static int check_frame(const struct reg_snapshot *snap, void *arg)
+{
+	unsigned long want[32];
 
-	for(i = 0; i < 128; i++) {
-		fp_load[i] = 1 + i;
-		fp_load_new[i] = 2 * (1 + i);
-		fp_load_ckpt[i] = 3 * (1 + i);
+	if ((snap->valid & (SNAP_VSX | SNAP_CVSX)) != (SNAP_VSX | SNAP_CVSX)) {
+		printf("no VSX state in the frame\n");
+		return TEST_FAIL;
 	}
 
-	tm_spd_vsx();
+	vsx_image(vsx_load, want);
+	if (tracer_expect("vsx", snap->live.vsx.vsr, want, 32))
+		return TEST_FAIL;
+	vsx_image(vsx_load_ckpt, want);
+	if (tracer_expect("ckpt vsx", snap->ckpt.vsx.vsr, want, 32))
+		return TEST_FAIL;
+	return TEST_PASS;
+}
+
+static int sigframe_vsx(void)
+{
+	SKIP_IF(!cpu_caps.htm);
 
-	return 0;
+	return sigframe_run("vsx_sigframe", vsx_init(), SIGFRAME_RUNS, check_frame, NULL);
 }
+
+TEST_REGISTER(sigframe_vsx, "vsx_sigframe");